@@ -0,0 +1,311 @@
+#!/bin/sh
+# Benchmark suite of the extension, run against a running openGauss server.
+#
+#   make bench
+#   BENCH_ROWS=10000000 BENCH_SESSIONS="1 8 64" ./benchmarks/bench.sh > results.json
+#
+# The server is the one of PGHOST, PGPORT, PGDATABASE and PGUSER. The extension has
+# to be created in that database and the user has to be a system admin. The modules
+# are registered under the bench_* namespaces, replacing earlier registrations.
+# Results are written as JSON to standard output, progress to standard error.
+#
+# Measured, all times from inside the server:
+#   call_overhead    ns per call of the nopN exports of noop.wasm, through
+#                    wasm_invoke_function and through the generated functions
+#   call_guards      ns per call of nop1 and of fib(20) with fuel_limit off and on and
+#                    interruptible off and on, set with ALTER SYSTEM and restored afterwards
+#   registration     ms to register a module generated with BENCH_EXPORTS exports of 12 arguments,
+#                    how many got their function, and ns per call of one of them
+#   throughput       rows per second over a table of BENCH_ROWS rows
+#   simd             values per second summed by wasm_invoke_array over arrays of BENCH_ROWS
+#                    values, by the scalar and the SIMD exports of simd.wasm, BENCH_ROWS bigint
+#                    values have to fit in wasm_executor.max_value_size
+#   cold_warm        first call of a session, which instantiates the module, and the next
+#   concurrency      calls per second of fib(20) over BENCH_SESSIONS concurrent sessions
+#   parallel_scan    rows per second over the same table, serial and with BENCH_DOP workers,
+#                    whether the plan went parallel and whether both gave the same result
+#   wasm_vs_plpgsql  ms per call of fib, gcd and sum, in wasm and in PL/pgSQL
+
+set -e
+cd "$(dirname "$0")/.."
+WASM_DIR=$(pwd)
+
+PSQL=${PSQL:-$(command -v gsql || echo psql)}
+BENCH_ROWS=${BENCH_ROWS:-1000000}
+BENCH_CALLS=${BENCH_CALLS:-100000}
+BENCH_SESSIONS=${BENCH_SESSIONS:-"1 2 4 8 16 32 64"}
+BENCH_SESSION_CALLS=${BENCH_SESSION_CALLS:-10000}
+BENCH_LOOPS=${BENCH_LOOPS:-100}
+BENCH_DOP=${BENCH_DOP:-4}
+BENCH_EXPORTS=${BENCH_EXPORTS:-2000}
+WAT2WASM=${WAT2WASM:-wat2wasm}
+
+log()
+{
+    echo "bench: $*" >&2
+}
+
+sql()
+{
+    "$PSQL" -X -q -t -A -v ON_ERROR_STOP=1 -c "$1"
+}
+
+# Milliseconds the query takes, run loops times in one session
+time_ms()
+{
+    sql "SELECT round(bench_time(\$bench\$$1\$bench\$, ${2:-1})::numeric, 3)"
+}
+
+# Nanoseconds per row of a query over calls rows
+per_call_ns()
+{
+    sql "SELECT round((bench_time(\$bench\$$1\$bench\$) * 1000000 / $2)::numeric, 1)"
+}
+
+# Change a setting of the server with ALTER SYSTEM and wait until new sessions see it
+set_server()
+{
+    sql "ALTER SYSTEM SET $1 = '$2'" > /dev/null
+    sql "SELECT pg_reload_conf()" > /dev/null
+    while [ "$(sql "SELECT current_setting('$1')")" != "$2" ]; do
+        sleep 0.1
+    done
+}
+
+# Register a module under a namespace with a volatility, replacing an earlier registration, and print its id
+register()
+{
+    sql "SELECT wasm_drop_instance(id) FROM wasm.instances WHERE wasm_file = '$WASM_DIR/$1'" > /dev/null
+    sql "SELECT wasm_new_instance('$WASM_DIR/$1', '$2', '${3:-volatile}')" > /dev/null
+    sql "SELECT id FROM wasm.instances WHERE wasm_file = '$WASM_DIR/$1'"
+}
+
+# Comma-separated list of count times the given argument
+repeat_args()
+{
+    args=""
+    i=0
+    while [ "$i" -lt "$1" ]; do
+        args="$args${args:+, }$2"
+        i=$((i + 1))
+    done
+    echo "$args"
+}
+
+log "setting up"
+"$PSQL" -X -q -v ON_ERROR_STOP=1 -f benchmarks/fib.sql > /dev/null
+"$PSQL" -X -q -v ON_ERROR_STOP=1 -f benchmarks/bench.sql > /dev/null
+NOOP_ID=$(register benchmarks/noop.wasm bench_noop)
+register benchmarks/fib.wasm bench_fib > /dev/null
+register examples/gcd.wasm bench_gcd immutable > /dev/null
+SUM_ID=$(register examples/sum.wasm bench_sum immutable)
+SIMD_ID=$(register benchmarks/simd.wasm bench_simd)
+
+VERSION=$(sql "SELECT version()" | sed 's/\\/\\\\/g; s/"/\\"/g')
+EXECUTION_MODE=$(sql "SELECT current_setting('wasm_executor.execution_mode')")
+INTERRUPTIBLE=$(sql "SELECT current_setting('wasm_executor.interruptible')")
+FUEL_LIMIT=$(sql "SELECT current_setting('wasm_executor.fuel_limit')")
+REVISION=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+# openGauss runs parallel plans with SMP threads, servers with parallel safety with workers
+if [ "$(sql "SELECT wasm_parallel_supported()")" = "t" ]; then
+    DOP_SETTING=max_parallel_workers_per_gather
+    SERIAL_DOP=0
+else
+    DOP_SETTING=query_dop
+    SERIAL_DOP=1
+fi
+
+log "call overhead over $BENCH_CALLS calls"
+BASELINE=$(per_call_ns "SELECT sum(abs(i::bigint)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+INVOKE_FUNCTION=""
+GENERATED=""
+n=0
+while [ "$n" -le 10 ]; do
+    args=$(repeat_args "$n" "i::bigint")
+    ns=$(per_call_ns "SELECT sum(wasm_invoke_function('$NOOP_ID', 'nop$n'${args:+, }$args)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+    INVOKE_FUNCTION="$INVOKE_FUNCTION${INVOKE_FUNCTION:+, }$ns"
+    ns=$(per_call_ns "SELECT sum(bench_noop_nop$n($args)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+    GENERATED="$GENERATED${GENERATED:+, }$ns"
+    n=$((n + 1))
+done
+
+log "call guards over $BENCH_CALLS calls"
+restore_guards()
+{
+    set_server wasm_executor.fuel_limit "$FUEL_LIMIT"
+    set_server wasm_executor.interruptible "$INTERRUPTIBLE"
+}
+trap restore_guards EXIT
+GUARDS=""
+for fuel in 0 1000000; do
+    for interruptible in off on; do
+        set_server wasm_executor.fuel_limit "$fuel"
+        set_server wasm_executor.interruptible "$interruptible"
+        nop_ns=$(per_call_ns "SELECT sum(bench_noop_nop1(i::bigint)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+        fib_ns=$(per_call_ns "SELECT sum(bench_fib_fibonacci(20)) FROM generate_series(1, $BENCH_SESSION_CALLS)" "$BENCH_SESSION_CALLS")
+        [ "$interruptible" = "on" ] && on=true || on=false
+        GUARDS="$GUARDS${GUARDS:+, }{\"fuel_limit\": $fuel, \"interruptible\": $on, \"nop1_ns\": $nop_ns, \"fib20_ns\": $fib_ns}"
+    done
+done
+restore_guards
+trap - EXIT
+
+log "registration of a module with $BENCH_EXPORTS exports"
+# f<i> takes 12 bigint arguments and returns one of them
+awk -v n="$BENCH_EXPORTS" 'BEGIN {
+    print "(module"
+    for (i = 0; i < n; i++) {
+        printf "  (func (export \"f%d\") (param i64 i64 i64 i64 i64 i64 i64 i64 i64 i64 i64 i64) (result i64)\n", i
+        printf "    local.get %d)\n", i % 12
+    }
+    print ")"
+}' > benchmarks/exports.wat
+"$WAT2WASM" benchmarks/exports.wat -o benchmarks/exports.wasm
+sql "SELECT wasm_drop_instance(id) FROM wasm.instances WHERE wasm_file = '$WASM_DIR/benchmarks/exports.wasm'" > /dev/null
+REGISTER_MS=$(time_ms "SELECT wasm_new_instance('$WASM_DIR/benchmarks/exports.wasm', 'bench_exports')")
+EXPORTS_ID=$(sql "SELECT id FROM wasm.instances WHERE wasm_file = '$WASM_DIR/benchmarks/exports.wasm'")
+GENERATED_EXPORTS=$(sql "SELECT count(funcoid) FROM wasm.exported_functions WHERE instanceid = $EXPORTS_ID")
+args=$(repeat_args 12 "i::bigint")
+WIDE_INVOKE=$(per_call_ns "SELECT sum(wasm_invoke_function('$EXPORTS_ID', 'f1', $args)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+WIDE_GENERATED=$(per_call_ns "SELECT sum(bench_exports_f1($args)) FROM generate_series(1, $BENCH_CALLS) AS i" "$BENCH_CALLS")
+sql "SELECT wasm_drop_instance($EXPORTS_ID)" > /dev/null
+
+log "throughput over $BENCH_ROWS rows"
+sql "DROP TABLE IF EXISTS bench_rows; CREATE TABLE bench_rows AS SELECT i AS a, i % 1000 + 1 AS b FROM generate_series(1, $BENCH_ROWS) AS i"
+rows_per_s()
+{
+    sql "SELECT round($BENCH_ROWS / (bench_time(\$bench\$$1\$bench\$) / 1000))"
+}
+SUM_RPS=$(rows_per_s "SELECT sum(bench_sum_sum(a, b)) FROM bench_rows")
+GCD_RPS=$(rows_per_s "SELECT sum(bench_gcd_gcd(a, b)) FROM bench_rows")
+BATCH_RPS=$(rows_per_s "SELECT wasm_invoke_batch($SUM_ID, 'sum', array_agg(a), array_agg(b)) FROM bench_rows")
+PLPGSQL_RPS=$(rows_per_s "SELECT sum(sum_plpgsql(a, b)) FROM bench_rows")
+
+log "simd sums over $BENCH_ROWS values"
+sql "DROP TABLE IF EXISTS bench_arrays; CREATE TABLE bench_arrays AS SELECT array_agg(a::bigint) AS bigints, array_agg(b) AS integers FROM bench_rows"
+SIMD=""
+simd_sum()
+{
+    scalar_vps=$(rows_per_s "SELECT wasm_invoke_array($SIMD_ID, 'sum_$1_scalar', $2) FROM bench_arrays")
+    simd_vps=$(rows_per_s "SELECT wasm_invoke_array($SIMD_ID, 'sum_$1_simd', $2) FROM bench_arrays")
+    scalar_result=$(sql "SELECT wasm_invoke_array($SIMD_ID, 'sum_$1_scalar', $2) FROM bench_arrays")
+    simd_result=$(sql "SELECT wasm_invoke_array($SIMD_ID, 'sum_$1_simd', $2) FROM bench_arrays")
+    if [ "$scalar_result" = "$simd_result" ]; then
+        same_result=true
+    else
+        same_result=false
+        log "sum_$1: scalar result $scalar_result, simd result $simd_result"
+    fi
+    SIMD="$SIMD${SIMD:+, }{\"name\": \"$1\", \"scalar_values_per_s\": $scalar_vps, \"simd_values_per_s\": $simd_vps, \"same_result\": $same_result}"
+}
+simd_sum i64 bigints
+simd_sum i32 integers
+sql "DROP TABLE bench_arrays"
+
+log "parallel scan with $BENCH_DOP workers"
+PARALLEL=""
+# Runs a statement after setting the degree of parallelism
+with_dop()
+{
+    sql "SET $DOP_SETTING = $1; $2"
+}
+parallel_scan()
+{
+    serial_rps=$(with_dop "$SERIAL_DOP" "SELECT round($BENCH_ROWS / (bench_time(\$bench\$$2\$bench\$) / 1000))")
+    parallel_rps=$(with_dop "$BENCH_DOP" "SELECT round($BENCH_ROWS / (bench_time(\$bench\$$2\$bench\$) / 1000))")
+    serial_result=$(with_dop "$SERIAL_DOP" "$2")
+    parallel_result=$(with_dop "$BENCH_DOP" "$2")
+    if with_dop "$BENCH_DOP" "EXPLAIN $2" | grep -q -E 'Gather|Streaming'; then
+        parallel_plan=true
+    else
+        parallel_plan=false
+    fi
+    if [ "$serial_result" = "$parallel_result" ]; then
+        same_result=true
+    else
+        same_result=false
+        log "$1: serial result $serial_result, parallel result $parallel_result"
+    fi
+    PARALLEL="$PARALLEL${PARALLEL:+, }{\"name\": \"$1\", \"serial_rows_per_s\": $serial_rps, \"parallel_rows_per_s\": $parallel_rps, \"parallel_plan\": $parallel_plan, \"same_result\": $same_result}"
+}
+parallel_scan "sum" "SELECT sum(bench_sum_sum(a, b)) FROM bench_rows"
+parallel_scan "gcd filter" "SELECT count(*) FROM bench_rows WHERE bench_gcd_gcd(a, b) > 1"
+sql "DROP TABLE bench_rows"
+
+log "cold and warm calls"
+# in one session, wasm_discard_cache prints an empty line
+set -- $(printf '%s\n' "SELECT wasm_discard_cache();" \
+    "SELECT round(bench_time('SELECT bench_fib_fibonacci(10)')::numeric, 3);" \
+    "SELECT round(bench_time('SELECT bench_fib_fibonacci(10)')::numeric, 3);" |
+    "$PSQL" -X -q -t -A -v ON_ERROR_STOP=1)
+COLD_MS=$1
+WARM_MS=$2
+
+CONCURRENCY=""
+for sessions in $BENCH_SESSIONS; do
+    log "$sessions concurrent sessions"
+    tmpdir=$(mktemp -d)
+    i=0
+    while [ "$i" -lt "$sessions" ]; do
+        time_ms "SELECT sum(bench_fib_fibonacci(20)) FROM generate_series(1, $BENCH_SESSION_CALLS)" > "$tmpdir/$i" &
+        i=$((i + 1))
+    done
+    wait
+    # the slowest session bounds the run
+    cps=$(cat "$tmpdir"/* | awk -v calls="$((sessions * BENCH_SESSION_CALLS))" \
+        '$1 > max { max = $1 } END { printf "%.0f", calls / (max / 1000) }')
+    rm -rf "$tmpdir"
+    CONCURRENCY="$CONCURRENCY${CONCURRENCY:+, }{\"sessions\": $sessions, \"calls_per_s\": $cps}"
+done
+
+log "wasm and PL/pgSQL"
+VERSUS=""
+versus()
+{
+    wasm_ms=$(time_ms "$2" "$BENCH_LOOPS")
+    plpgsql_ms=$(time_ms "$3" "$BENCH_LOOPS")
+    VERSUS="$VERSUS${VERSUS:+, }{\"name\": \"$1\", \"wasm_ms\": $wasm_ms, \"plpgsql_ms\": $plpgsql_ms}"
+}
+for n in 50 500 5000; do
+    versus "fib($n)" "SELECT bench_fib_fibonacci($n)" "SELECT fibonacci($n)"
+done
+versus "gcd x 1000" "SELECT sum(bench_gcd_gcd(i, 1071)) FROM generate_series(1, 1000) AS i" \
+    "SELECT sum(gcd_plpgsql(i, 1071)) FROM generate_series(1, 1000) AS i"
+versus "sum x 1000" "SELECT sum(bench_sum_sum(i, 1)) FROM generate_series(1, 1000) AS i" \
+    "SELECT sum(sum_plpgsql(i, 1)) FROM generate_series(1, 1000) AS i"
+
+cat <<EOF
+{
+  "timestamp": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "revision": "$REVISION",
+  "server": "$VERSION",
+  "settings": {"execution_mode": "$EXECUTION_MODE", "interruptible": "$INTERRUPTIBLE", "fuel_limit": $FUEL_LIMIT},
+  "call_overhead": {
+    "calls": $BENCH_CALLS,
+    "baseline_ns": $BASELINE,
+    "invoke_function_ns": [$INVOKE_FUNCTION],
+    "generated_ns": [$GENERATED]
+  },
+  "call_guards": {"calls": $BENCH_CALLS, "fib20_calls": $BENCH_SESSION_CALLS, "results": [$GUARDS]},
+  "registration": {
+    "exports": $BENCH_EXPORTS,
+    "register_ms": $REGISTER_MS,
+    "generated_functions": $GENERATED_EXPORTS,
+    "invoke_function_12_ns": $WIDE_INVOKE,
+    "generated_12_ns": $WIDE_GENERATED
+  },
+  "throughput": {
+    "rows": $BENCH_ROWS,
+    "sum_rows_per_s": $SUM_RPS,
+    "gcd_rows_per_s": $GCD_RPS,
+    "batch_sum_rows_per_s": $BATCH_RPS,
+    "plpgsql_sum_rows_per_s": $PLPGSQL_RPS
+  },
+  "simd": {"values": $BENCH_ROWS, "results": [$SIMD]},
+  "cold_warm": {"cold_ms": $COLD_MS, "warm_ms": $WARM_MS},
+  "concurrency": [$CONCURRENCY],
+  "parallel_scan": {"rows": $BENCH_ROWS, "workers": $BENCH_DOP, "setting": "$DOP_SETTING", "results": [$PARALLEL]},
+  "wasm_vs_plpgsql": {"loops": $BENCH_LOOPS, "results": [$VERSUS]}
+}
+EOF
+log "done"
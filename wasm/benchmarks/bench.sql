@@ -0,0 +1,34 @@
+-- Helpers and PL/pgSQL counterparts of the examples for bench.sh, next to fib.sql.
+
+-- Run query loops times and return the elapsed time in milliseconds, measured in the server
+CREATE OR REPLACE FUNCTION bench_time(query text, loops integer DEFAULT 1) RETURNS double precision AS $$
+DECLARE
+    started timestamptz;
+BEGIN
+    started := clock_timestamp();
+    FOR i IN 1 .. loops LOOP
+        EXECUTE query;
+    END LOOP;
+    RETURN extract(epoch FROM clock_timestamp() - started) * 1000;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION gcd_plpgsql (a integer, b integer) RETURNS integer AS $$
+DECLARE
+    t integer;
+BEGIN
+    WHILE b <> 0 LOOP
+        t := b;
+        b := a % b;
+        a := t;
+    END LOOP;
+
+    RETURN a;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION sum_plpgsql (a integer, b integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + b;
+END;
+$$ LANGUAGE plpgsql;
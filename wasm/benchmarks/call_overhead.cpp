@@ -0,0 +1,144 @@
+/*
+ * Per-call overhead of the ways wasm_vm_execute can run a call, outside the server.
+ *
+ * The same export is called over and over on one VM:
+ *   plain          WasmEdge_VMExecute on a VM without cost measuring
+ *   fuel           cost measuring on, with the limit set before every call
+ *   interruptible  cost measuring on and the call run through WasmEdge_VMAsyncExecute,
+ *                  waited for in slices like the server does
+ *
+ *   make call_overhead
+ *   ./benchmarks/call_overhead [calls] [n] [wasm file]
+ *
+ * The wasm file defaults to benchmarks/fib.wasm, whose fibonacci(n) is called.
+ * A small n shows the fixed cost per call, a large one the cost per instruction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include <wasmedge/wasmedge.h>
+
+#define POLL_MS 10
+#define FUEL_PER_CALL 1000000000ULL
+
+typedef enum CallMode {
+    CALL_PLAIN,
+    CALL_FUEL,
+    CALL_INTERRUPTIBLE
+} CallMode;
+
+static const char *call_mode_names[] = {"plain", "fuel", "interruptible"};
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static WasmEdge_VMContext* build_vm(const std::vector<uint8_t> &bytes, bool cost_measuring)
+{
+    WasmEdge_ConfigureContext *config_context = WasmEdge_ConfigureCreate();
+    WasmEdge_ConfigureStatisticsSetCostMeasuring(config_context, cost_measuring);
+    WasmEdge_VMContext *vm = WasmEdge_VMCreate(config_context, NULL);
+    WasmEdge_ConfigureDelete(config_context);
+    if (!WasmEdge_ResultOK(WasmEdge_VMLoadWasmFromBuffer(vm, bytes.data(), bytes.size())) ||
+        !WasmEdge_ResultOK(WasmEdge_VMValidate(vm)) ||
+        !WasmEdge_ResultOK(WasmEdge_VMInstantiate(vm))) {
+        WasmEdge_VMDelete(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+static WasmEdge_Result call_once(WasmEdge_VMContext *vm, CallMode mode, WasmEdge_String func,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    if (mode != CALL_PLAIN) {
+        WasmEdge_StatisticsContext *stat = WasmEdge_VMGetStatisticsContext(vm);
+        WasmEdge_StatisticsSetCostLimit(stat, WasmEdge_StatisticsGetTotalCost(stat) + FUEL_PER_CALL);
+    }
+    if (mode != CALL_INTERRUPTIBLE) {
+        return WasmEdge_VMExecute(vm, func, params, 1, returns, 1);
+    }
+
+    WasmEdge_Async *async = WasmEdge_VMAsyncExecute(vm, func, params, 1);
+    while (!WasmEdge_AsyncWaitFor(async, POLL_MS)) {
+        // the server checks for interrupts here
+    }
+    WasmEdge_Result ret = WasmEdge_AsyncGet(async, returns, 1);
+    WasmEdge_AsyncDelete(async);
+    return ret;
+}
+
+static bool run_mode(const std::vector<uint8_t> &bytes, CallMode mode, long calls, int n)
+{
+    WasmEdge_VMContext *vm = build_vm(bytes, mode != CALL_PLAIN);
+    if (vm == NULL) {
+        fprintf(stderr, "call_overhead: could not instantiate the module\n");
+        return false;
+    }
+    WasmEdge_String func = WasmEdge_StringCreateByCString("fibonacci");
+    WasmEdge_Value params[1] = {WasmEdge_ValueGenI32(n)};
+    WasmEdge_Value returns[1];
+    bool ok = true;
+
+    double start = now_seconds();
+    for (long i = 0; i < calls; ++i) {
+        if (!WasmEdge_ResultOK(call_once(vm, mode, func, params, returns))) {
+            fprintf(stderr, "call_overhead: call %ld failed\n", i);
+            ok = false;
+            break;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    if (ok) {
+        printf("%-14s calls=%ld n=%d ns/call=%.0f\n", call_mode_names[mode], calls, n, elapsed * 1e9 / calls);
+    }
+    WasmEdge_StringDelete(func);
+    WasmEdge_VMDelete(vm);
+    return ok;
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &bytes)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t nread;
+    while ((nread = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + nread);
+    }
+    fclose(file);
+    return !bytes.empty();
+}
+
+int main(int argc, char **argv)
+{
+    long calls = (argc > 1) ? atol(argv[1]) : 100000;
+    int n = (argc > 2) ? atoi(argv[2]) : 10;
+    const char *wasm_file = (argc > 3) ? argv[3] : "benchmarks/fib.wasm";
+    std::vector<uint8_t> bytes;
+
+    if (calls <= 0 || n < 0) {
+        fprintf(stderr, "usage: %s [calls] [n] [wasm file]\n", argv[0]);
+        return 1;
+    }
+    if (!read_file(wasm_file, bytes)) {
+        fprintf(stderr, "call_overhead: could not read %s\n", wasm_file);
+        return 1;
+    }
+
+    for (int mode = CALL_PLAIN; mode <= CALL_INTERRUPTIBLE; ++mode) {
+        if (!run_mode(bytes, (CallMode)mode, calls, n)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Per-call cost of the isolations of wasm_new_instance, outside the server.
+ *
+ * The export is called over and over:
+ *   shared          on one VM, every call sees what the earlier ones left
+ *   snapshot_copy   on one VM, the memory and the mutable globals copied back from
+ *                   the snapshot before every call
+ *   snapshot_remap  the same, the memory image mapped copy-on-write over the memory
+ *   fresh           on a VM created, loaded and instantiated for the call
+ *
+ *   make isolation
+ *   ./benchmarks/isolation [calls] [wasm file] [export]
+ *
+ * The wasm file defaults to examples/counter.wasm, whose next() counts its calls in
+ * the linear memory: shared returns the number of calls so far, the others always 1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <vector>
+
+#include <wasmedge/wasmedge.h>
+
+#define WASM_PAGE_SIZE 65536
+
+typedef enum IsolationMode {
+    ISOLATION_SHARED,
+    ISOLATION_SNAPSHOT_COPY,
+    ISOLATION_SNAPSHOT_REMAP,
+    ISOLATION_FRESH
+} IsolationMode;
+
+static const char *isolation_mode_names[] = {"shared", "snapshot_copy", "snapshot_remap", "fresh"};
+
+typedef struct Snapshot {
+    WasmEdge_MemoryInstanceContext *memory;
+    uint8_t *base;
+    size_t size;
+    int memfd;
+    std::vector<uint8_t> image;
+    std::vector<WasmEdge_GlobalInstanceContext *> globals;
+    std::vector<WasmEdge_Value> global_values;
+} Snapshot;
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static WasmEdge_VMContext* build_vm(const std::vector<uint8_t> &bytes)
+{
+    WasmEdge_VMContext *vm = WasmEdge_VMCreate(NULL, NULL);
+    if (!WasmEdge_ResultOK(WasmEdge_VMLoadWasmFromBuffer(vm, bytes.data(), bytes.size())) ||
+        !WasmEdge_ResultOK(WasmEdge_VMValidate(vm)) ||
+        !WasmEdge_ResultOK(WasmEdge_VMInstantiate(vm))) {
+        WasmEdge_VMDelete(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+static bool take_snapshot(WasmEdge_VMContext *vm, Snapshot &snapshot)
+{
+    const WasmEdge_ModuleInstanceContext *module_cxt = WasmEdge_VMGetActiveModule(vm);
+    WasmEdge_String name;
+    if (WasmEdge_ModuleInstanceListMemory(module_cxt, &name, 1) < 1) {
+        return false;
+    }
+    snapshot.memory = WasmEdge_ModuleInstanceFindMemory(module_cxt, name);
+    snapshot.size = (size_t)WasmEdge_MemoryInstanceGetPageSize(snapshot.memory) * WASM_PAGE_SIZE;
+    snapshot.base = WasmEdge_MemoryInstanceGetPointer(snapshot.memory, 0, 1);
+    if (snapshot.size == 0 || snapshot.base == NULL) {
+        return false;
+    }
+    snapshot.image.assign(snapshot.base, snapshot.base + snapshot.size);
+    snapshot.memfd = (int)syscall(SYS_memfd_create, "isolation", 0);
+    if (snapshot.memfd < 0 || write(snapshot.memfd, snapshot.base, snapshot.size) != (ssize_t)snapshot.size) {
+        return false;
+    }
+
+    uint32_t global_num = WasmEdge_ModuleInstanceListGlobalLength(module_cxt);
+    std::vector<WasmEdge_String> names(global_num);
+    global_num = WasmEdge_ModuleInstanceListGlobal(module_cxt, names.data(), global_num);
+    for (uint32_t i = 0; i < global_num; ++i) {
+        WasmEdge_GlobalInstanceContext *global = WasmEdge_ModuleInstanceFindGlobal(module_cxt, names[i]);
+        if (WasmEdge_GlobalTypeGetMutability(WasmEdge_GlobalInstanceGetGlobalType(global)) == WasmEdge_Mutability_Var) {
+            snapshot.globals.push_back(global);
+            snapshot.global_values.push_back(WasmEdge_GlobalInstanceGetValue(global));
+        }
+    }
+    return true;
+}
+
+// Like wasm_snapshot_restore of the extension, without the memory that grew
+static bool restore_snapshot(Snapshot &snapshot, bool remap)
+{
+    if (remap) {
+        if (mmap(snapshot.base, snapshot.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            snapshot.memfd, 0) == MAP_FAILED) {
+            return false;
+        }
+    } else {
+        memcpy(snapshot.base, snapshot.image.data(), snapshot.size);
+    }
+    for (size_t i = 0; i < snapshot.globals.size(); ++i) {
+        WasmEdge_GlobalInstanceSetValue(snapshot.globals[i], snapshot.global_values[i]);
+    }
+    return true;
+}
+
+static bool run_mode(const std::vector<uint8_t> &bytes, IsolationMode mode, long calls, const char *export_name)
+{
+    WasmEdge_VMContext *vm = NULL;
+    Snapshot snapshot;
+    snapshot.memfd = -1;
+    if (mode != ISOLATION_FRESH) {
+        vm = build_vm(bytes);
+        if (vm == NULL) {
+            fprintf(stderr, "isolation: could not instantiate the module\n");
+            return false;
+        }
+        if (mode != ISOLATION_SHARED && !take_snapshot(vm, snapshot)) {
+            fprintf(stderr, "isolation: could not take the snapshot of the module\n");
+            WasmEdge_VMDelete(vm);
+            return false;
+        }
+    }
+    WasmEdge_String func = WasmEdge_StringCreateByCString(export_name);
+    WasmEdge_Value returns[1];
+    bool ok = true;
+
+    double start = now_seconds();
+    for (long i = 0; ok && i < calls; ++i) {
+        if (mode == ISOLATION_FRESH) {
+            vm = build_vm(bytes);
+            ok = (vm != NULL);
+        } else if (mode != ISOLATION_SHARED && i > 0) {
+            ok = restore_snapshot(snapshot, mode == ISOLATION_SNAPSHOT_REMAP);
+        }
+        if (ok && !WasmEdge_ResultOK(WasmEdge_VMExecute(vm, func, NULL, 0, returns, 1))) {
+            ok = false;
+        }
+        if (mode == ISOLATION_FRESH && vm != NULL) {
+            WasmEdge_VMDelete(vm);
+            vm = NULL;
+        }
+        if (!ok) {
+            fprintf(stderr, "isolation: call %ld failed\n", i);
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    if (ok) {
+        printf("%-15s calls=%ld ns/call=%.0f last=%ld\n", isolation_mode_names[mode], calls, elapsed * 1e9 / calls,
+            (long)WasmEdge_ValueGetI64(returns[0]));
+    }
+    WasmEdge_StringDelete(func);
+    if (snapshot.memfd >= 0) {
+        close(snapshot.memfd);
+    }
+    if (vm != NULL) {
+        WasmEdge_VMDelete(vm);
+    }
+    return ok;
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &bytes)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t nread;
+    while ((nread = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + nread);
+    }
+    fclose(file);
+    return !bytes.empty();
+}
+
+int main(int argc, char **argv)
+{
+    long calls = (argc > 1) ? atol(argv[1]) : 10000;
+    const char *wasm_file = (argc > 2) ? argv[2] : "examples/counter.wasm";
+    const char *export_name = (argc > 3) ? argv[3] : "next";
+    std::vector<uint8_t> bytes;
+
+    if (calls <= 0) {
+        fprintf(stderr, "usage: %s [calls] [wasm file] [export]\n", argv[0]);
+        return 1;
+    }
+    if (!read_file(wasm_file, bytes)) {
+        fprintf(stderr, "isolation: could not read %s\n", wasm_file);
+        return 1;
+    }
+
+    for (int mode = ISOLATION_SHARED; mode <= ISOLATION_FRESH; ++mode) {
+        if (!run_mode(bytes, (IsolationMode)mode, calls, export_name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+(module
+  ;; nopN takes N bigint arguments and returns 0, to measure the cost of a call
+  ;; through wasm_invoke_function and through the generated functions.
+  (func (export "nop0") (result i64)
+    i64.const 0)
+  (func (export "nop1") (param i64) (result i64)
+    i64.const 0)
+  (func (export "nop2") (param i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop3") (param i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop4") (param i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop5") (param i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop6") (param i64 i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop7") (param i64 i64 i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop8") (param i64 i64 i64 i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop9") (param i64 i64 i64 i64 i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+  (func (export "nop10") (param i64 i64 i64 i64 i64 i64 i64 i64 i64 i64) (result i64)
+    i64.const 0)
+)
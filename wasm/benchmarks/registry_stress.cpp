@@ -0,0 +1,242 @@
+/*
+ * Multi-threaded stress benchmark of the instance registry, outside the server.
+ *
+ * Every thread stands for a session: it looks instances up, instantiates its own
+ * VM of each one on first use and calls an export of it, while a share of the
+ * operations registers new instances. The same workload is run against the
+ * sharded registry of wasm_registry.h and against a map behind a single mutex.
+ *
+ *   make registry_stress
+ *   ./benchmarks/registry_stress [threads] [seconds] [wasm file] [create per mille]
+ *
+ * The wasm file defaults to benchmarks/fib.wasm, whose fibonacci(i32) is called.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include <atomic>
+
+#include <wasmedge/wasmedge.h>
+
+#include "../wasm_registry.h"
+
+#define STRESS_INSTANCES 1024
+
+typedef struct StressInstance {
+    int64_t instanceid;
+    std::vector<uint8_t> bytes;
+} StressInstance;
+
+// The registry before sharding, for comparison
+template <typename Key, typename Value>
+class MutexMap {
+public:
+    bool lookup(const Key &key, Value &value)
+    {
+        bool found = false;
+        pthread_mutex_lock(&lock);
+        typename std::map<Key, Value>::iterator itor = map.find(key);
+        if (itor != map.end()) {
+            value = itor->second;
+            found = true;
+        }
+        pthread_mutex_unlock(&lock);
+        return found;
+    }
+
+    bool insert(const Key &key, Value &value)
+    {
+        pthread_mutex_lock(&lock);
+        std::pair<typename std::map<Key, Value>::iterator, bool> inserted =
+            map.insert(std::pair<Key, Value>(key, value));
+        value = inserted.first->second;
+        pthread_mutex_unlock(&lock);
+        return inserted.second;
+    }
+
+private:
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    std::map<Key, Value> map;
+};
+
+static std::vector<uint8_t> module_bytes;
+static int run_seconds = 5;
+static int create_per_mille = 10;
+static std::atomic<bool> stop(false);
+
+typedef struct StressCounters {
+    uint64_t lookups;
+    uint64_t creates;
+    uint64_t invokes;
+    uint64_t failures;
+} StressCounters;
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static WasmEdge_VMContext* build_vm(const StressInstance *instance)
+{
+    WasmEdge_VMContext *vm = WasmEdge_VMCreate(NULL, NULL);
+    if (!WasmEdge_ResultOK(WasmEdge_VMLoadWasmFromBuffer(vm, instance->bytes.data(), instance->bytes.size())) ||
+        !WasmEdge_ResultOK(WasmEdge_VMValidate(vm)) ||
+        !WasmEdge_ResultOK(WasmEdge_VMInstantiate(vm))) {
+        WasmEdge_VMDelete(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+template <typename Registry>
+struct StressArgs {
+    Registry *registry;
+    int threadno;
+    StressCounters counters;
+};
+
+template <typename Registry>
+static void* stress_thread(void *arg)
+{
+    StressArgs<Registry> *args = (StressArgs<Registry> *)arg;
+    Registry *registry = args->registry;
+    StressCounters &counters = args->counters;
+    std::map<int64_t, WasmEdge_VMContext*> vms; // like session_vms
+    WasmEdge_String func = WasmEdge_StringCreateByCString("fibonacci");
+    uint32_t state = 2463534242u + args->threadno;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        int64_t instanceid = next_random(state) % STRESS_INSTANCES;
+
+        if ((int)(next_random(state) % 1000) < create_per_mille) {
+            StressInstance *instance = new StressInstance();
+            instance->instanceid = instanceid;
+            instance->bytes = module_bytes;
+            StressInstance *published = instance;
+            if (!registry->insert(instanceid, published)) {
+                delete instance;
+            }
+            counters.creates++;
+            continue;
+        }
+
+        StressInstance *instance = NULL;
+        counters.lookups++;
+        if (!registry->lookup(instanceid, instance)) {
+            continue;
+        }
+
+        WasmEdge_VMContext *vm = NULL;
+        std::map<int64_t, WasmEdge_VMContext*>::iterator itor = vms.find(instanceid);
+        if (itor != vms.end()) {
+            vm = itor->second;
+        } else {
+            vm = build_vm(instance);
+            if (vm == NULL) {
+                counters.failures++;
+                continue;
+            }
+            vms.insert(std::pair<int64_t, WasmEdge_VMContext*>(instanceid, vm));
+        }
+
+        WasmEdge_Value params[1] = {WasmEdge_ValueGenI32(20)};
+        WasmEdge_Value returns[1];
+        if (WasmEdge_ResultOK(WasmEdge_VMExecute(vm, func, params, 1, returns, 1))) {
+            counters.invokes++;
+        } else {
+            counters.failures++;
+        }
+    }
+
+    for (std::map<int64_t, WasmEdge_VMContext*>::iterator itor = vms.begin(); itor != vms.end(); itor++) {
+        WasmEdge_VMDelete(itor->second);
+    }
+    WasmEdge_StringDelete(func);
+    return NULL;
+}
+
+template <typename Registry>
+static void run_stress(const char *name, int nthreads)
+{
+    Registry registry;
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<StressArgs<Registry> > args(nthreads);
+
+    stop.store(false);
+    double start = now_seconds();
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].registry = &registry;
+        args[i].threadno = i;
+        memset(&args[i].counters, 0, sizeof(StressCounters));
+        pthread_create(&threads[i], NULL, stress_thread<Registry>, &args[i]);
+    }
+    struct timespec duration = {run_seconds, 0};
+    nanosleep(&duration, NULL);
+    stop.store(true);
+
+    StressCounters total = {0, 0, 0, 0};
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        total.lookups += args[i].counters.lookups;
+        total.creates += args[i].counters.creates;
+        total.invokes += args[i].counters.invokes;
+        total.failures += args[i].counters.failures;
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%-8s threads=%d lookups/s=%.0f creates/s=%.0f invokes/s=%.0f failures=%llu\n",
+        name, nthreads, total.lookups / elapsed, total.creates / elapsed, total.invokes / elapsed,
+        (unsigned long long)total.failures);
+    // the instances are not freed, just like retired registry entries
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &bytes)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t nread;
+    while ((nread = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + nread);
+    }
+    fclose(file);
+    return !bytes.empty();
+}
+
+int main(int argc, char **argv)
+{
+    int nthreads = (argc > 1) ? atoi(argv[1]) : 16;
+    run_seconds = (argc > 2) ? atoi(argv[2]) : 5;
+    const char *wasm_file = (argc > 3) ? argv[3] : "benchmarks/fib.wasm";
+    create_per_mille = (argc > 4) ? atoi(argv[4]) : 10;
+
+    if (nthreads <= 0 || run_seconds <= 0 || create_per_mille < 0 || create_per_mille > 1000) {
+        fprintf(stderr, "usage: %s [threads] [seconds] [wasm file] [create per mille]\n", argv[0]);
+        return 1;
+    }
+    if (!read_file(wasm_file, module_bytes)) {
+        fprintf(stderr, "registry_stress: could not read %s\n", wasm_file);
+        return 1;
+    }
+
+    run_stress<MutexMap<int64_t, StressInstance*> >("mutex", nthreads);
+    run_stress<WasmShardedMap<int64_t, StressInstance*> >("sharded", nthreads);
+    return 0;
+}
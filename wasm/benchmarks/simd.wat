@@ -0,0 +1,234 @@
+;; Sums of a whole array, in scalar code and with the SIMD proposal, to measure what
+;; the vector instructions gain through wasm_invoke_array:
+;;
+;;   SELECT wasm_invoke_array(id, 'sum_i64_simd', array_agg(x::bigint)) ...
+;;
+;; The _scalar exports add one value at a time. The _simd ones add two bigint
+;; lanes at a time, or four integer ones widened to bigint, and the values left
+;; over one at a time. The v128 accumulators stay inside the module.
+(module
+  (memory (export "memory") 1)
+  (global $heap (mut i32) (i32.const 1024))
+
+  ;; Bump allocator, growing the memory when the heap runs past its end.
+  (func $alloc (export "alloc") (param $size i32) (result i32)
+    (local $ptr i32)
+    global.get $heap
+    local.set $ptr
+    local.get $ptr
+    local.get $size
+    i32.add
+    i32.const 15
+    i32.add
+    i32.const -16
+    i32.and
+    global.set $heap
+    block  ;; label = @1
+      loop  ;; label = @2
+        global.get $heap
+        memory.size
+        i32.const 16
+        i32.shl
+        i32.le_u
+        br_if 1 (;@1;)
+        i32.const 1
+        memory.grow
+        i32.const -1
+        i32.eq
+        if  ;; label = @3
+          i32.const 0
+          return
+        end
+        br 0 (;@2;)
+      end
+    end
+    local.get $ptr)
+
+  ;; The whole heap is released at once.
+  (func $dealloc (export "dealloc") (param i32 i32)
+    i32.const 1024
+    global.set $heap)
+
+  (func $sum_i64_scalar (export "sum_i64_scalar") (param $ptr i32) (param $len i32) (result i64)
+    (local $end i32)
+    (local $acc i64)
+    local.get $ptr
+    local.get $len
+    i32.const 3
+    i32.shl
+    i32.add
+    local.set $end
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $end
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $acc
+        local.get $ptr
+        i64.load
+        i64.add
+        local.set $acc
+        local.get $ptr
+        i32.const 8
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $acc)
+
+  (func $sum_i64_simd (export "sum_i64_simd") (param $ptr i32) (param $len i32) (result i64)
+    (local $end i32)
+    (local $vend i32)
+    (local $vacc v128)
+    (local $acc i64)
+    local.get $ptr
+    local.get $len
+    i32.const 3
+    i32.shl
+    i32.add
+    local.set $end
+    local.get $ptr
+    local.get $len
+    i32.const -2
+    i32.and
+    i32.const 3
+    i32.shl
+    i32.add
+    local.set $vend
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $vend
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $vacc
+        local.get $ptr
+        v128.load
+        i64x2.add
+        local.set $vacc
+        local.get $ptr
+        i32.const 16
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $vacc
+    i64x2.extract_lane 0
+    local.get $vacc
+    i64x2.extract_lane 1
+    i64.add
+    local.set $acc
+    local.get $ptr
+    local.get $end
+    i32.lt_u
+    if  ;; label = @1
+      local.get $acc
+      local.get $ptr
+      i64.load
+      i64.add
+      local.set $acc
+    end
+    local.get $acc)
+
+  (func $sum_i32_scalar (export "sum_i32_scalar") (param $ptr i32) (param $len i32) (result i64)
+    (local $end i32)
+    (local $acc i64)
+    local.get $ptr
+    local.get $len
+    i32.const 2
+    i32.shl
+    i32.add
+    local.set $end
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $end
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $acc
+        local.get $ptr
+        i64.load32_s
+        i64.add
+        local.set $acc
+        local.get $ptr
+        i32.const 4
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $acc)
+
+  (func $sum_i32_simd (export "sum_i32_simd") (param $ptr i32) (param $len i32) (result i64)
+    (local $end i32)
+    (local $vend i32)
+    (local $v v128)
+    (local $vacc v128)
+    (local $acc i64)
+    local.get $ptr
+    local.get $len
+    i32.const 2
+    i32.shl
+    i32.add
+    local.set $end
+    local.get $ptr
+    local.get $len
+    i32.const -4
+    i32.and
+    i32.const 2
+    i32.shl
+    i32.add
+    local.set $vend
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $vend
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $ptr
+        v128.load
+        local.set $v
+        local.get $vacc
+        local.get $v
+        i64x2.extend_low_i32x4_s
+        i64x2.add
+        local.get $v
+        i64x2.extend_high_i32x4_s
+        i64x2.add
+        local.set $vacc
+        local.get $ptr
+        i32.const 16
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $vacc
+    i64x2.extract_lane 0
+    local.get $vacc
+    i64x2.extract_lane 1
+    i64.add
+    local.set $acc
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $end
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $acc
+        local.get $ptr
+        i64.load32_s
+        i64.add
+        local.set $acc
+        local.get $ptr
+        i32.const 4
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $acc)
+)
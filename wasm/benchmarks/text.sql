@@ -0,0 +1,40 @@
+-- PL/pgSQL equivalents of the functions of text.wat, for the text/bytea benchmark.
+--
+--   SELECT wasm_new_instance('/absolute/path/to/text.wasm', 'text');
+--   SELECT wasm_declare_signature(id, 'fnv1a', 'text', 'bigint') FROM wasm.instances WHERE wasm_file LIKE '%text.wasm';
+--   SELECT wasm_declare_signature(id, 'upper', 'text', 'text') FROM wasm.instances WHERE wasm_file LIKE '%text.wasm';
+--   CREATE TABLE words AS SELECT repeat(md5(i::text), 32) AS word FROM generate_series(1, 10000) AS i;
+--   \timing on
+--   SELECT sum(text_fnv1a(word)) FROM words;
+--   SELECT sum(fnv1a(word)) FROM words;
+--   SELECT count(DISTINCT text_upper(word)) FROM words;
+--   SELECT count(DISTINCT upper_ascii(word)) FROM words;
+
+CREATE OR REPLACE FUNCTION fnv1a (input text) RETURNS bigint AS $$
+DECLARE
+    bytes bytea := convert_to(input, 'UTF8');
+    hash bigint := 2166136261;
+BEGIN
+    FOR i IN 0 .. length(bytes) - 1 LOOP
+        hash := ((hash # get_byte(bytes, i)) * 16777619) % 4294967296;
+    END LOOP;
+
+    RETURN hash;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION upper_ascii (input text) RETURNS text AS $$
+DECLARE
+    bytes bytea := convert_to(input, 'UTF8');
+    c integer;
+BEGIN
+    FOR i IN 0 .. length(bytes) - 1 LOOP
+        c := get_byte(bytes, i);
+        IF c BETWEEN 97 AND 122 THEN
+            bytes := set_byte(bytes, i, c - 32);
+        END IF;
+    END LOOP;
+
+    RETURN convert_from(bytes, 'UTF8');
+END;
+$$ LANGUAGE plpgsql;
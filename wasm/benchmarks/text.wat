@@ -0,0 +1,133 @@
+;; Text functions for the text/bytea benchmark, see text.sql.
+;;
+;;   wat2wasm text.wat -o text.wasm
+(module
+  (memory (export "memory") 1)
+  (global $heap (mut i32) (i32.const 1024))
+
+  ;; Bump allocator, growing the memory when the heap runs past its end.
+  (func $alloc (export "alloc") (param $size i32) (result i32)
+    (local $ptr i32)
+    global.get $heap
+    local.set $ptr
+    local.get $ptr
+    local.get $size
+    i32.add
+    i32.const 7
+    i32.add
+    i32.const -8
+    i32.and
+    global.set $heap
+    block  ;; label = @1
+      loop  ;; label = @2
+        global.get $heap
+        memory.size
+        i32.const 16
+        i32.shl
+        i32.le_u
+        br_if 1 (;@1;)
+        i32.const 1
+        memory.grow
+        i32.const -1
+        i32.eq
+        if  ;; label = @3
+          i32.const 0
+          return
+        end
+        br 0 (;@2;)
+      end
+    end
+    local.get $ptr)
+
+  ;; The whole heap is released at once.
+  (func $dealloc (export "dealloc") (param i32 i32)
+    i32.const 1024
+    global.set $heap)
+
+  ;; 32-bit FNV-1a hash of len bytes at ptr, declared as fnv1a(text) -> bigint.
+  (func $fnv1a (export "fnv1a") (param $ptr i32) (param $len i32) (result i64)
+    (local $hash i32)
+    (local $end i32)
+    i32.const -2128831035  ;; 2166136261
+    local.set $hash
+    local.get $ptr
+    local.get $len
+    i32.add
+    local.set $end
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $end
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $hash
+        local.get $ptr
+        i32.load8_u
+        i32.xor
+        i32.const 16777619
+        i32.mul
+        local.set $hash
+        local.get $ptr
+        i32.const 1
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $hash
+    i64.extend_i32_u)
+
+  ;; ASCII upper case of len bytes at ptr into a new buffer, declared as upper(text) -> text.
+  ;; Returns the buffer as ptr << 32 | len.
+  (func $upper (export "upper") (param $ptr i32) (param $len i32) (result i64)
+    (local $out i32)
+    (local $i i32)
+    (local $c i32)
+    local.get $len
+    i32.const 1
+    local.get $len
+    select
+    call $alloc
+    local.set $out
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $i
+        local.get $len
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $ptr
+        local.get $i
+        i32.add
+        i32.load8_u
+        local.set $c
+        local.get $c
+        i32.const 97
+        i32.sub
+        i32.const 26
+        i32.lt_u
+        if  ;; label = @3
+          local.get $c
+          i32.const 32
+          i32.sub
+          local.set $c
+        end
+        local.get $out
+        local.get $i
+        i32.add
+        local.get $c
+        i32.store8
+        local.get $i
+        i32.const 1
+        i32.add
+        local.set $i
+        br 0 (;@2;)
+      end
+    end
+    local.get $out
+    i64.extend_i32_u
+    i64.const 32
+    i64.shl
+    local.get $len
+    i64.extend_i32_u
+    i64.or)
+)
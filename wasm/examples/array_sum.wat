@@ -0,0 +1,73 @@
+(module
+  (memory (export "memory") 1)
+  (global $heap (mut i32) (i32.const 1024))
+
+  ;; Bump allocator, growing the memory when the heap runs past its end.
+  (func $alloc (export "alloc") (param $size i32) (result i32)
+    (local $ptr i32)
+    global.get $heap
+    local.set $ptr
+    local.get $ptr
+    local.get $size
+    i32.add
+    i32.const 7
+    i32.add
+    i32.const -8
+    i32.and
+    global.set $heap
+    block  ;; label = @1
+      loop  ;; label = @2
+        global.get $heap
+        memory.size
+        i32.const 16
+        i32.shl
+        i32.le_u
+        br_if 1 (;@1;)
+        i32.const 1
+        memory.grow
+        i32.const -1
+        i32.eq
+        if  ;; label = @3
+          i32.const 0
+          return
+        end
+        br 0 (;@2;)
+      end
+    end
+    local.get $ptr)
+
+  ;; The whole heap is released at once.
+  (func $dealloc (export "dealloc") (param i32 i32)
+    i32.const 1024
+    global.set $heap)
+
+  ;; Sum of len bigint values starting at ptr.
+  (func $sum_i64 (export "sum_i64") (param $ptr i32) (param $len i32) (result i64)
+    (local $acc i64)
+    (local $end i32)
+    local.get $ptr
+    local.get $len
+    i32.const 3
+    i32.shl
+    i32.add
+    local.set $end
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $ptr
+        local.get $end
+        i32.ge_u
+        br_if 1 (;@1;)
+        local.get $acc
+        local.get $ptr
+        i64.load
+        i64.add
+        local.set $acc
+        local.get $ptr
+        i32.const 8
+        i32.add
+        local.set $ptr
+        br 0 (;@2;)
+      end
+    end
+    local.get $acc)
+)
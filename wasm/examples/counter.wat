@@ -0,0 +1,29 @@
+;; Counts its calls, to try the isolation of wasm_new_instance on:
+;;
+;;   SELECT wasm_new_instance('/absolute/path/to/counter.wasm', 'shared');
+;;   SELECT wasm_new_instance('/absolute/path/to/counter.wasm', 'isolated', 'volatile', 'snapshot');
+;;
+;; next() counts in its linear memory and calls() in a global. Shared, they return
+;; 1, 2, 3... over the calls of a session; isolated by snapshot, always 1. The memory
+;; has the 17 pages of a Rust module, which makes a snapshot restore it by remapping.
+(module
+  (memory (export "memory") 17)
+  (global $calls (export "counter_calls") (mut i64) (i64.const 0))
+
+  (func (export "next") (result i64)
+    i32.const 1024
+    i32.const 1024
+    i64.load
+    i64.const 1
+    i64.add
+    i64.store
+    global.get $calls
+    i64.const 1
+    i64.add
+    global.set $calls
+    i32.const 1024
+    i64.load)
+
+  (func (export "calls") (result i64)
+    global.get $calls)
+)
@@ -0,0 +1,18 @@
+;; A multi-value export, generated as a function returning a record:
+;;
+;;   SELECT wasm_new_instance('/absolute/path/to/divmod.wasm', 'dm');
+;;   SELECT * FROM dm_divmod(17, 5);
+;;    result1 | result2
+;;   ---------+---------
+;;          3 |       2
+;;
+;; divmod(a, b) returns the quotient and the remainder of a by b in one call.
+(module
+  (func $divmod (export "divmod") (param $a i64) (param $b i64) (result i64 i64)
+    local.get $a
+    local.get $b
+    i64.div_s
+    local.get $a
+    local.get $b
+    i64.rem_s)
+)
@@ -0,0 +1,82 @@
+;; An aggregate computing the integer mean of bigint values, generated as
+;; <namespace>_mean(bigint) by wasm_new_instance.
+;;
+;; The state is 16 bytes of the linear memory: the sum followed by the count.
+(module
+  (memory (export "memory") 1)
+  (global $heap (mut i32) (i32.const 1024))
+
+  ;; A new, zeroed state for every group.
+  (func $mean_init (export "mean_init") (result i32)
+    (local $state i32)
+    global.get $heap
+    local.set $state
+    global.get $heap
+    i32.const 16
+    i32.add
+    global.set $heap
+    global.get $heap
+    memory.size
+    i32.const 16
+    i32.shl
+    i32.gt_u
+    if  ;; label = @1
+      i32.const 1
+      memory.grow
+      drop
+    end
+    local.get $state
+    i64.const 0
+    i64.store
+    local.get $state
+    i64.const 0
+    i64.store offset=8
+    local.get $state)
+
+  (func $mean_step (export "mean_step") (param $state i32) (param $value i64) (result i32)
+    local.get $state
+    local.get $state
+    i64.load
+    local.get $value
+    i64.add
+    i64.store
+    local.get $state
+    local.get $state
+    i64.load offset=8
+    i64.const 1
+    i64.add
+    i64.store offset=8
+    local.get $state)
+
+  ;; Adds the partial state $other into $state.
+  (func $mean_combine (export "mean_combine") (param $state i32) (param $other i32) (result i32)
+    local.get $state
+    local.get $state
+    i64.load
+    local.get $other
+    i64.load
+    i64.add
+    i64.store
+    local.get $state
+    local.get $state
+    i64.load offset=8
+    local.get $other
+    i64.load offset=8
+    i64.add
+    i64.store offset=8
+    local.get $state)
+
+  (func $mean_final (export "mean_final") (param $state i32) (result i64)
+    local.get $state
+    i64.load offset=8
+    i64.eqz
+    if  ;; label = @1
+      i64.const 0
+      return
+    end
+    local.get $state
+    i64.load
+    local.get $state
+    i64.load offset=8
+    i64.div_s)
+)
@@ -0,0 +1,138 @@
+;; A scan kernel reading a table through the host functions of wasm_executor,
+;; instead of being called once per row:
+;;
+;;   SELECT wasm_new_instance('/absolute/path/to/scan.wasm', 'scan');
+;;   SELECT wasm_declare_signature(id, 'sum_column', 'text', 'bigint')
+;;   FROM wasm.instances WHERE wasm_file = '/absolute/path/to/scan.wasm';
+;;   SELECT scan_sum_column('SELECT amount FROM orders');
+;;
+;; sum_column(query) sums the first column of the query, which has to be integer
+;; or bigint. It fetches up to 8192 rows at a time into the first page of the
+;; memory, the column kind at 0 and the batch from 8 on. Nulls are fetched as 0,
+;; so the values are summed without looking at the null bytes after them.
+(module
+  (import "opengauss" "cursor_open" (func $cursor_open (param i32 i32) (result i32)))
+  (import "opengauss" "cursor_columns" (func $cursor_columns (param i32 i32 i32) (result i32)))
+  (import "opengauss" "cursor_fetch" (func $cursor_fetch (param i32 i32 i32 i32) (result i32)))
+  (import "opengauss" "cursor_close" (func $cursor_close (param i32)))
+
+  (memory (export "memory") 2)
+  (global $heap (mut i32) (i32.const 65536))
+
+  ;; Bump allocator above the batch page, growing the memory when the heap runs past its end.
+  (func $alloc (export "alloc") (param $size i32) (result i32)
+    (local $ptr i32)
+    global.get $heap
+    local.set $ptr
+    local.get $ptr
+    local.get $size
+    i32.add
+    i32.const 7
+    i32.add
+    i32.const -8
+    i32.and
+    global.set $heap
+    block  ;; label = @1
+      loop  ;; label = @2
+        global.get $heap
+        memory.size
+        i32.const 16
+        i32.shl
+        i32.le_u
+        br_if 1 (;@1;)
+        i32.const 1
+        memory.grow
+        i32.const -1
+        i32.eq
+        if  ;; label = @3
+          i32.const 0
+          return
+        end
+        br 0 (;@2;)
+      end
+    end
+    local.get $ptr)
+
+  ;; The whole heap is released at once.
+  (func $dealloc (export "dealloc") (param i32 i32)
+    i32.const 65536
+    global.set $heap)
+
+  (func $sum_column (export "sum_column") (param $query i32) (param $len i32) (result i64)
+    (local $cursor i32)
+    (local $width i32)
+    (local $rows i32)
+    (local $ptr i32)
+    (local $end i32)
+    (local $acc i64)
+    local.get $query
+    local.get $len
+    call $cursor_open
+    local.set $cursor
+    local.get $cursor
+    i32.const 0
+    i32.const 1
+    call $cursor_columns
+    drop
+    ;; kind 1 is i64, anything else is taken for i32
+    i32.const 4
+    local.set $width
+    i32.const 0
+    i32.load
+    i32.const 1
+    i32.eq
+    if  ;; label = @1
+      i32.const 8
+      local.set $width
+    end
+    block  ;; label = @1
+      loop  ;; label = @2
+        local.get $cursor
+        i32.const 8192
+        i32.const 8
+        i32.const 65528
+        call $cursor_fetch
+        local.tee $rows
+        i32.eqz
+        br_if 1 (;@1;)
+        i32.const 8
+        local.set $ptr
+        local.get $rows
+        local.get $width
+        i32.mul
+        i32.const 8
+        i32.add
+        local.set $end
+        block  ;; label = @3
+          loop  ;; label = @4
+            local.get $ptr
+            local.get $end
+            i32.ge_u
+            br_if 1 (;@3;)
+            local.get $acc
+            local.get $width
+            i32.const 8
+            i32.eq
+            if (result i64)  ;; label = @5
+              local.get $ptr
+              i64.load
+            else
+              local.get $ptr
+              i64.load32_s
+            end
+            i64.add
+            local.set $acc
+            local.get $ptr
+            local.get $width
+            i32.add
+            local.set $ptr
+            br 0 (;@4;)
+          end
+        end
+        br 0 (;@2;)
+      end
+    end
+    local.get $cursor
+    call $cursor_close
+    local.get $acc)
+)
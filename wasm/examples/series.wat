@@ -0,0 +1,71 @@
+;; A set-returning function generated as <namespace>_series(bigint, bigint) by
+;; wasm_new_instance, returning the values from start to stop one at a time.
+;;
+;; The handle points to 16 bytes of the linear memory: the next value followed by
+;; the last one.
+(module
+  (memory (export "memory") 1)
+  (global $heap (mut i32) (i32.const 1024))
+
+  ;; Bump allocator for the value buffer of the executor, the heap is never reused.
+  (func $alloc (export "alloc") (param $size i32) (result i32)
+    (local $ptr i32)
+    global.get $heap
+    local.set $ptr
+    local.get $ptr
+    local.get $size
+    i32.add
+    i32.const 7
+    i32.add
+    i32.const -8
+    i32.and
+    global.set $heap
+    global.get $heap
+    memory.size
+    i32.const 16
+    i32.shl
+    i32.gt_u
+    if  ;; label = @1
+      i32.const 1
+      memory.grow
+      drop
+    end
+    local.get $ptr)
+
+  (func $series_open (export "series_open") (param $start i64) (param $stop i64) (result i32)
+    (local $handle i32)
+    i32.const 16
+    call $alloc
+    local.set $handle
+    local.get $handle
+    local.get $start
+    i64.store
+    local.get $handle
+    local.get $stop
+    i64.store offset=8
+    local.get $handle)
+
+  ;; Stores the next value at $out, returns 0 when the series is exhausted.
+  (func $series_next (export "series_next") (param $handle i32) (param $out i32) (result i32)
+    (local $value i64)
+    local.get $handle
+    i64.load
+    local.set $value
+    local.get $value
+    local.get $handle
+    i64.load offset=8
+    i64.gt_s
+    if  ;; label = @1
+      i32.const 0
+      return
+    end
+    local.get $out
+    local.get $value
+    i64.store
+    local.get $handle
+    local.get $value
+    i64.const 1
+    i64.add
+    i64.store
+    i32.const 1)
+)
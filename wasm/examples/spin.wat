@@ -0,0 +1,12 @@
+(module
+  ;; Never returns, to try query cancel, statement_timeout and fuel_limit on.
+  (func $spin (export "spin") (param $n i32) (result i32)
+    loop  ;; label = @1
+      local.get $n
+      i32.const 1
+      i32.add
+      local.set $n
+      br 0 (;@1;)
+    end
+    local.get $n)
+)
@@ -8,7 +8,17 @@ CREATE SCHEMA wasm;
 
 CREATE TABLE wasm.instances(
     id           bigint,
-    wasm_file    text
+    wasm_file    text,
+    volatility   text,
+    isolation    text,
+    module_hash  text,
+    features     text
+);
+
+-- Modules registered with wasm_new_instance_from_bytes, by the SHA-256 of their bytes
+CREATE TABLE wasm.modules(
+    hash         text PRIMARY KEY,
+    bytes        bytea NOT NULL
 );
 
 CREATE TABLE wasm.exported_functions(
@@ -16,7 +26,25 @@ CREATE TABLE wasm.exported_functions(
     namespace     text,
     funcname      text,
     inputs        text,
-    outputs       text
+    outputs       text,
+    funcoid       oid
+);
+-- Modules may export thousands of functions, each generated and looked up by name
+CREATE INDEX exported_functions_funcname ON wasm.exported_functions(instanceid, funcname);
+
+CREATE TABLE wasm.aggregates(
+    instanceid    bigint,
+    aggname       text,
+    aggoid        oid,
+    stepoid       oid,
+    combineoid    oid,
+    finaloid      oid
+);
+
+CREATE TABLE wasm.set_functions(
+    instanceid    bigint,
+    funcname      text,
+    funcoid       oid
 );
 
 CREATE FUNCTION wasm_get_instances(
@@ -37,131 +65,507 @@ RETURNS SETOF record
 AS 'MODULE_PATHNAME', 'wasm_get_exported_functions'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_create_new_instance(text)
+CREATE FUNCTION wasm_create_new_instance(text, text DEFAULT 'shared', text DEFAULT 'volatile',
+    text DEFAULT 'simd,bulk_memory,multi_value')
 RETURNS int8
 AS 'MODULE_PATHNAME', 'wasm_create_instance'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_0(text, text)
+CREATE FUNCTION wasm_create_new_instance_from_bytes(bytea, text DEFAULT 'shared', text DEFAULT 'volatile',
+    text DEFAULT 'simd,bulk_memory,multi_value')
 RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_0'
+AS 'MODULE_PATHNAME', 'wasm_create_instance_from_bytes'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_1(text, text, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_1'
+CREATE FUNCTION wasm_module_hash(bytea)
+RETURNS text
+AS 'MODULE_PATHNAME', 'wasm_module_hash'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION wasm_discard_cache()
+RETURNS void
+AS 'MODULE_PATHNAME', 'wasm_discard_cache'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_2(text, text, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_2'
+-- Times are in milliseconds, latency_histogram counts the calls by execution time:
+-- element 1 below 1 us, element i in [2^(i-2), 2^(i-1)) us, the last one above.
+CREATE FUNCTION wasm_stat_functions(
+    OUT instanceid        bigint,
+    OUT funcname          text,
+    OUT calls             bigint,
+    OUT errors            bigint,
+    OUT exec_time         double precision,
+    OUT max_exec_time     double precision,
+    OUT marshal_time      double precision,
+    OUT memo_hits         bigint,
+    OUT memo_misses       bigint,
+    OUT latency_histogram bigint[]
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'wasm_stat_functions'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_3(text, text, int8, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_3'
+CREATE FUNCTION wasm_stat_instances(
+    OUT instanceid       bigint,
+    OUT loads            bigint,
+    OUT load_time        double precision,
+    OUT compiles         bigint,
+    OUT compile_time     double precision,
+    OUT instantiations   bigint,
+    OUT instantiate_time double precision,
+    OUT vm_hits          bigint,
+    OUT vm_misses        bigint,
+    OUT restores         bigint,
+    OUT restore_time     double precision,
+    OUT evictions        bigint,
+    OUT vms              bigint,
+    OUT memory           bigint
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'wasm_stat_instances'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_4(text, text, int8, int8, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_4'
+-- What the live VMs of every instance hold right now, over all sessions, in bytes
+CREATE VIEW wasm.memory_usage AS
+    SELECT instanceid, vms, memory, evictions FROM wasm_stat_instances() WHERE vms > 0 OR evictions > 0;
+
+CREATE FUNCTION wasm_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'wasm_stat_reset'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_5(text, text, int8, int8, int8, int8, int8)
+-- The generic entry point, for exports taking any number of integers:
+--   SELECT wasm_invoke_function('2785875771', 'sum', 1, 2);
+CREATE FUNCTION wasm_invoke_function(text, text)
 RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_5'
+AS 'MODULE_PATHNAME', 'wasm_invoke_function_variadic'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_6(text, text, int8, int8, int8, int8, int8, int8)
+CREATE FUNCTION wasm_invoke_function(text, text, VARIADIC int8[])
 RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_6'
+AS 'MODULE_PATHNAME', 'wasm_invoke_function_variadic'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_7(text, text, int8, int8, int8, int8, int8, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_7'
+-- The entry points of 0 to 10 arguments of earlier versions, inlined into wasm_invoke_function
+CREATE FUNCTION wasm_invoke_function_0(text, text) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_1(text, text, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_2(text, text, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_3(text, text, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_4(text, text, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_5(text, text, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_6(text, text, int8, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7, $8);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_7(text, text, int8, int8, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7, $8, $9);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_8(text, text, int8, int8, int8, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7, $8, $9, $10);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_9(text, text, int8, int8, int8, int8, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_function_10(text, text, int8, int8, int8, int8, int8, int8, int8, int8, int8, int8) RETURNS int8 AS $$
+    SELECT wasm_invoke_function($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12);
+$$ LANGUAGE sql STRICT;
+
+CREATE FUNCTION wasm_invoke_batch(int8, text, VARIADIC "any")
+RETURNS int8[]
+AS 'MODULE_PATHNAME', 'wasm_invoke_batch'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_8(text, text, int8, int8, int8, int8, int8, int8, int8, int8)
+CREATE FUNCTION wasm_invoke_array(int8, text, anyarray)
 RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_8'
+AS 'MODULE_PATHNAME', 'wasm_invoke_array'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_9(text, text, int8, int8, int8, int8, int8, int8, int8, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_9'
+CREATE FUNCTION wasm_bind_function(oid, int8, text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'wasm_bind_function'
 LANGUAGE C STRICT;
 
-CREATE FUNCTION wasm_invoke_function_10(text, text, int8, int8, int8, int8, int8, int8, int8, int8, int8, int8)
-RETURNS int8
-AS 'MODULE_PATHNAME', 'wasm_invoke_function_10'
+CREATE FUNCTION wasm_remove_instance(int8)
+RETURNS void
+AS 'MODULE_PATHNAME', 'wasm_remove_instance'
 LANGUAGE C STRICT;
 
-CREATE OR REPLACE FUNCTION wasm_new_instance(module_pathname text, namespace text) RETURNS text AS $$
+CREATE FUNCTION wasm_declare_function(int8, text, text, text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'wasm_declare_function'
+LANGUAGE C STRICT;
+
+-- Whether the server knows about parallel safety, i.e. pg_proc has proparallel. openGauss
+-- does not: its SMP plans (query_dop) have no parallel safety marking of functions, so there
+-- the generated functions only get their volatility and none of the PARALLEL clauses below.
+CREATE OR REPLACE FUNCTION wasm_parallel_supported() RETURNS boolean AS $$
+    SELECT EXISTS (SELECT 1 FROM pg_attribute WHERE attrelid = 'pg_proc'::regclass AND attname = 'proparallel');
+$$ LANGUAGE sql STABLE;
+
+-- The volatility and parallel safety of the functions generated for an instance. Exports
+-- registered as immutable or stable are parallel safe, each worker calling them in a VM of
+-- its own. Volatile ones may keep state in the session VM, so they stay in the leader.
+CREATE OR REPLACE FUNCTION wasm_function_options(instance_id int8) RETURNS text AS $$
+DECLARE
+    instance_volatility text;
+BEGIN
+    SELECT coalesce(volatility, 'volatile') INTO instance_volatility FROM wasm.instances WHERE id = instance_id;
+    IF instance_volatility IS NULL THEN
+        instance_volatility := 'volatile';
+    END IF;
+
+    IF NOT wasm_parallel_supported() THEN
+        RETURN upper(instance_volatility);
+    ELSIF instance_volatility = 'volatile' THEN
+        RETURN 'VOLATILE PARALLEL RESTRICTED';
+    ELSE
+        RETURN upper(instance_volatility) || ' PARALLEL SAFE';
+    END IF;
+END;
+$$ LANGUAGE plpgsql STABLE;
+
+-- Create the SQL function of an exported function and bind it to the export.
+CREATE OR REPLACE FUNCTION wasm_generate_function(instance_id int8, namespace text, funcname text, inputs text, outputs text) RETURNS regprocedure AS $$
+DECLARE
+    generated_arguments text := inputs;
+    generated_outputs text;
+    generated_function regprocedure;
+BEGIN
+    IF strpos(outputs, ',') > 0 THEN
+        -- The results of a multi-value export are the columns result1, result2, ... of a record.
+        SELECT
+            string_agg(format('OUT result%s %s', i, (regexp_split_to_array(outputs, ','))[i]), ', ' ORDER BY i)
+        INTO
+            generated_outputs
+        FROM
+            generate_subscripts(regexp_split_to_array(outputs, ','), 1) AS i;
+        IF length(inputs) > 0 THEN
+            generated_arguments := inputs || ', ' || generated_outputs;
+        ELSE
+            generated_arguments := generated_outputs;
+        END IF;
+        generated_outputs := 'record';
+    ELSIF length(outputs) > 0 THEN
+        generated_outputs := outputs;
+    ELSE
+        generated_outputs := 'void';
+    END IF;
+
+    -- The generated function calls the export directly from C, see wasm_invoke_export.
+    EXECUTE format(
+        'CREATE OR REPLACE FUNCTION %I_%I(%s) RETURNS %s AS %L, %L LANGUAGE C STRICT %s;',
+        namespace,
+        funcname,
+        generated_arguments,
+        generated_outputs,
+        'MODULE_PATHNAME',
+        'wasm_invoke_export',
+        wasm_function_options(instance_id)
+    );
+    generated_function := format('%I_%I(%s)', namespace, funcname, inputs)::regprocedure;
+    PERFORM wasm_bind_function(generated_function, instance_id, funcname);
+    UPDATE wasm.exported_functions SET funcoid = generated_function
+        WHERE instanceid = instance_id AND exported_functions.funcname = wasm_generate_function.funcname;
+    RETURN generated_function;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Create an aggregate from the <aggname>_init, _step, _final and optionally _combine exports.
+CREATE OR REPLACE FUNCTION wasm_generate_aggregate(instance_id int8, namespace text, aggname text) RETURNS regprocedure AS $$
+DECLARE
+    step_inputs text;
+    final_outputs text;
+    has_combine boolean;
+    parallel_clause text := '';
+    generated_aggregate RECORD;
+    stepoid regprocedure;
+    combineoid regprocedure;
+    finaloid regprocedure;
+    aggoid regprocedure;
+BEGIN
+    SELECT inputs INTO STRICT step_inputs FROM wasm_get_exported_functions(instance_id) WHERE funcname = aggname || '_step';
+    SELECT outputs INTO STRICT final_outputs FROM wasm_get_exported_functions(instance_id) WHERE funcname = aggname || '_final';
+    SELECT count(*) > 0 INTO has_combine FROM wasm_get_exported_functions(instance_id) WHERE funcname = aggname || '_combine';
+
+    -- The first argument of the step is the address of the state.
+    IF step_inputs NOT LIKE 'integer,%' THEN
+        RAISE EXCEPTION 'WebAssembly exported function `%_step` has to take the state and at least one value.', aggname;
+    END IF;
+    step_inputs := substr(step_inputs, length('integer,') + 1);
+
+    FOR generated_aggregate IN SELECT * FROM wasm.aggregates WHERE instanceid = instance_id AND wasm.aggregates.aggname = wasm_generate_aggregate.aggname
+    LOOP
+        EXECUTE format('DROP AGGREGATE IF EXISTS %s;', generated_aggregate.aggoid::regprocedure);
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_aggregate.stepoid::regprocedure);
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_aggregate.finaloid::regprocedure);
+        IF generated_aggregate.combineoid IS NOT NULL THEN
+            EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_aggregate.combineoid::regprocedure);
+        END IF;
+    END LOOP;
+    DELETE FROM wasm.aggregates WHERE instanceid = instance_id AND wasm.aggregates.aggname = wasm_generate_aggregate.aggname;
+
+    -- The state lives in the linear memory of the session VM, see wasm_aggregate_step. The
+    -- states of parallel workers would be in VMs the leader cannot combine them in.
+    IF wasm_parallel_supported() THEN
+        parallel_clause := ' PARALLEL RESTRICTED';
+    END IF;
+    EXECUTE format('CREATE OR REPLACE FUNCTION %I_%I_sfunc(internal, %s) RETURNS internal AS %L, %L LANGUAGE C%s;',
+        namespace, aggname, step_inputs, 'MODULE_PATHNAME', 'wasm_aggregate_step', parallel_clause);
+    stepoid := format('%I_%I_sfunc(internal, %s)', namespace, aggname, step_inputs)::regprocedure;
+    PERFORM wasm_bind_function(stepoid, instance_id, aggname || '_step');
+
+    EXECUTE format('CREATE OR REPLACE FUNCTION %I_%I_ffunc(internal) RETURNS %s AS %L, %L LANGUAGE C%s;',
+        namespace, aggname, final_outputs, 'MODULE_PATHNAME', 'wasm_aggregate_final', parallel_clause);
+    finaloid := format('%I_%I_ffunc(internal)', namespace, aggname)::regprocedure;
+    PERFORM wasm_bind_function(finaloid, instance_id, aggname || '_final');
+
+    IF has_combine THEN
+        EXECUTE format('CREATE OR REPLACE FUNCTION %I_%I_cfunc(internal, internal) RETURNS internal AS %L, %L LANGUAGE C%s;',
+            namespace, aggname, 'MODULE_PATHNAME', 'wasm_aggregate_combine', parallel_clause);
+        combineoid := format('%I_%I_cfunc(internal, internal)', namespace, aggname)::regprocedure;
+        PERFORM wasm_bind_function(combineoid, instance_id, aggname || '_combine');
+        EXECUTE format('CREATE AGGREGATE %I_%I(%s) (SFUNC = %s, STYPE = internal, FINALFUNC = %s, CFUNC = %s%s);',
+            namespace, aggname, step_inputs, stepoid::regproc, finaloid::regproc, combineoid::regproc,
+            replace(parallel_clause, ' PARALLEL ', ', PARALLEL = '));
+    ELSE
+        EXECUTE format('CREATE AGGREGATE %I_%I(%s) (SFUNC = %s, STYPE = internal, FINALFUNC = %s%s);',
+            namespace, aggname, step_inputs, stepoid::regproc, finaloid::regproc,
+            replace(parallel_clause, ' PARALLEL ', ', PARALLEL = '));
+    END IF;
+    aggoid := format('%I_%I(%s)', namespace, aggname, step_inputs)::regprocedure;
+
+    INSERT INTO wasm.aggregates VALUES (instance_id, aggname, aggoid, stepoid, combineoid, finaloid);
+    RETURN aggoid;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Create a set-returning function from the <funcname>_open, _next and optionally _close exports.
+CREATE OR REPLACE FUNCTION wasm_generate_set_function(instance_id int8, namespace text, funcname text) RETURNS regprocedure AS $$
+DECLARE
+    open_inputs text;
+    generated_function regprocedure;
+BEGIN
+    SELECT inputs INTO STRICT open_inputs FROM wasm_get_exported_functions(instance_id)
+        WHERE wasm_get_exported_functions.funcname = wasm_generate_set_function.funcname || '_open';
+
+    -- The values are streamed from the session VM, see wasm_invoke_srf.
+    EXECUTE format('CREATE OR REPLACE FUNCTION %I_%I(%s) RETURNS SETOF bigint AS %L, %L LANGUAGE C STRICT %s;',
+        namespace, funcname, open_inputs, 'MODULE_PATHNAME', 'wasm_invoke_srf', wasm_function_options(instance_id));
+    generated_function := format('%I_%I(%s)', namespace, funcname, open_inputs)::regprocedure;
+    PERFORM wasm_bind_function(generated_function, instance_id, funcname || '_open');
+
+    DELETE FROM wasm.set_functions WHERE instanceid = instance_id AND wasm.set_functions.funcname = wasm_generate_set_function.funcname;
+    INSERT INTO wasm.set_functions VALUES (instance_id, funcname, generated_function);
+    RETURN generated_function;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Record the exports of a registered instance and generate its functions, aggregates and
+-- set-returning functions.
+CREATE OR REPLACE FUNCTION wasm_generate_functions(instance_id int8, namespace text) RETURNS void AS $$
 DECLARE
-    current_instance_id int8;
     exported_function RECORD;
-    exported_function_generated_inputs text;
-    exported_function_generated_outputs text;
 BEGIN
-    -- Create a new instance, and stores its ID in `current_instance_id`.
-    SELECT wasm_create_new_instance(module_pathname) INTO STRICT current_instance_id;
-   
-    -- Insert the wasm information to gloable table 
-    INSERT INTO wasm.instances SELECT id, wasm_file FROM wasm_get_instances() WHERE id = current_instance_id;
-    INSERT INTO wasm.exported_functions SELECT current_instance_id, namespace, funcname, inputs, outputs FROM wasm_get_exported_functions(current_instance_id);
-    
+    DELETE FROM wasm.exported_functions WHERE instanceid = instance_id;
+    INSERT INTO wasm.exported_functions SELECT instance_id, namespace, funcname, inputs, outputs FROM wasm_get_exported_functions(instance_id);
+
     -- Generate functions for each exported functions from the WebAssembly instance.
+    FOR
+        exported_function
+    IN
+        SELECT funcname, inputs, outputs FROM wasm.exported_functions WHERE instanceid = instance_id
+    LOOP
+        PERFORM wasm_generate_function(instance_id, namespace, exported_function.funcname,
+            exported_function.inputs, exported_function.outputs);
+    END LOOP;
+
+    -- Generate an aggregate for each set of <name>_init, <name>_step and <name>_final exports.
     FOR
         exported_function
     IN
         SELECT
-            funcname,
-            inputs,
-            CASE
-                WHEN length(inputs) = 0 THEN 0
-                ELSE array_length(regexp_split_to_array(inputs, ','), 1)
-            END AS input_arity,
-            outputs
+            left(funcname, -length('_step')) AS aggname
         FROM
-            (SELECT * FROM wasm_get_exported_functions(current_instance_id))
+            wasm.exported_functions
+        WHERE
+            instanceid = instance_id AND funcname LIKE '%\_step'
     LOOP
-        IF exported_function.input_arity > 10 THEN
-           RAISE EXCEPTION 'WebAssembly exported function `%` has an arity greater than 10, which is not supported yet.', exported_function.funcname;
+        IF EXISTS (SELECT 1 FROM wasm.exported_functions WHERE instanceid = instance_id AND funcname = exported_function.aggname || '_init')
+            AND EXISTS (SELECT 1 FROM wasm.exported_functions WHERE instanceid = instance_id AND funcname = exported_function.aggname || '_final') THEN
+            PERFORM wasm_generate_aggregate(instance_id, namespace, exported_function.aggname);
         END IF;
+    END LOOP;
 
-        exported_function_generated_inputs := '';
-        exported_function_generated_outputs := '';
+    -- Generate a set-returning function for each pair of <name>_open and <name>_next exports.
+    FOR
+        exported_function
+    IN
+        SELECT
+            left(funcname, -length('_open')) AS setname
+        FROM
+            wasm.exported_functions
+        WHERE
+            instanceid = instance_id AND funcname LIKE '%\_open'
+    LOOP
+        IF EXISTS (SELECT 1 FROM wasm.exported_functions WHERE instanceid = instance_id AND funcname = exported_function.setname || '_next') THEN
+            PERFORM wasm_generate_set_function(instance_id, namespace, exported_function.setname);
+        END IF;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
 
-        FOR nth IN 1..exported_function.input_arity LOOP
-            exported_function_generated_inputs := exported_function_generated_inputs || format(', CAST($%s AS int8)', nth);
-        END LOOP;
+-- volatility is the one of the generated functions: immutable, stable or volatile.
+-- isolation is what a call finds in the VM: shared, what earlier calls left there, or
+-- snapshot, the state of right after instantiation.
+-- features are the proposals beyond the MVP the module may use, among simd, bulk_memory
+-- and multi_value.
+CREATE OR REPLACE FUNCTION wasm_new_instance(module_pathname text, namespace text, volatility text DEFAULT 'volatile',
+    isolation text DEFAULT 'shared', features text DEFAULT 'simd,bulk_memory,multi_value') RETURNS text AS $$
+DECLARE
+    current_instance_id int8;
+    instance_volatility text := lower(volatility);
+BEGIN
+    IF instance_volatility NOT IN ('immutable', 'stable', 'volatile') THEN
+        RAISE EXCEPTION 'volatility has to be immutable, stable or volatile, not %', volatility;
+    END IF;
 
-        IF length(exported_function.outputs) > 0 THEN
-            exported_function_generated_outputs := exported_function.outputs;
-        ELSE
-            exported_function_generated_outputs := 'integer';
+    -- Create a new instance, and stores its ID in `current_instance_id`.
+    SELECT wasm_create_new_instance(module_pathname, lower(isolation), instance_volatility, lower(features))
+        INTO STRICT current_instance_id;
+   
+    -- Insert the wasm information to gloable table, replacing what an earlier call left there
+    DELETE FROM wasm.instances WHERE id = current_instance_id;
+    INSERT INTO wasm.instances SELECT id, wasm_file, instance_volatility, lower(isolation), NULL, lower(features)
+        FROM wasm_get_instances() WHERE id = current_instance_id;
+    PERFORM wasm_generate_functions(current_instance_id, namespace);
+
+    RETURN current_instance_id;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Like wasm_new_instance, for a module given as bytes. They are kept in wasm.modules, once
+-- for all the registrations of the same bytes, so that the instance needs no file, neither
+-- on this server nor on its standbys.
+CREATE OR REPLACE FUNCTION wasm_new_instance_from_bytes(module bytea, namespace text, volatility text DEFAULT 'volatile',
+    isolation text DEFAULT 'shared', features text DEFAULT 'simd,bulk_memory,multi_value') RETURNS text AS $$
+DECLARE
+    current_instance_id int8;
+    instance_volatility text := lower(volatility);
+    content_hash text := wasm_module_hash(module);
+BEGIN
+    IF instance_volatility NOT IN ('immutable', 'stable', 'volatile') THEN
+        RAISE EXCEPTION 'volatility has to be immutable, stable or volatile, not %', volatility;
+    END IF;
+
+    IF NOT EXISTS (SELECT 1 FROM wasm.modules WHERE hash = content_hash) THEN
+        INSERT INTO wasm.modules VALUES (content_hash, module);
+    END IF;
+    SELECT wasm_create_new_instance_from_bytes(module, lower(isolation), instance_volatility, lower(features))
+        INTO STRICT current_instance_id;
+
+    DELETE FROM wasm.instances WHERE id = current_instance_id;
+    INSERT INTO wasm.instances VALUES (current_instance_id, NULL, instance_volatility, lower(isolation), content_hash,
+        lower(features));
+    PERFORM wasm_generate_functions(current_instance_id, namespace);
+
+    RETURN current_instance_id;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION wasm_drop_instance(instance_id int8) RETURNS void AS $$
+DECLARE
+    generated_function RECORD;
+BEGIN
+    -- Drop the generated aggregates and functions first, so that nothing can call into the instance any more.
+    FOR
+        generated_function
+    IN
+        SELECT * FROM wasm.aggregates WHERE instanceid = instance_id
+    LOOP
+        EXECUTE format('DROP AGGREGATE IF EXISTS %s;', generated_function.aggoid::regprocedure);
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_function.stepoid::regprocedure);
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_function.finaloid::regprocedure);
+        IF generated_function.combineoid IS NOT NULL THEN
+            EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_function.combineoid::regprocedure);
         END IF;
+    END LOOP;
 
-        EXECUTE format(
-            'CREATE OR REPLACE FUNCTION %I_%I(%3$s) RETURNS %5$s AS $F$' ||
-            'DECLARE' ||
-            '    output %5$s;' ||
-            'BEGIN' ||
-            '    SELECT wasm_invoke_function_%4$s(%6$L, %2$L%7$s) INTO STRICT output;' ||
-            '    RETURN output;' ||
-            'END;' ||
-            '$F$ LANGUAGE plpgsql;',
-            namespace, -- 1
-            exported_function.funcname, -- 2
-            exported_function.inputs, -- 3
-            exported_function.input_arity, -- 4
-            exported_function_generated_outputs, -- 5
-            current_instance_id, -- 6
-            exported_function_generated_inputs -- 7
-        );
+    FOR
+        generated_function
+    IN
+        SELECT funcoid FROM wasm.exported_functions WHERE instanceid = instance_id AND funcoid IS NOT NULL
+        UNION ALL
+        SELECT funcoid FROM wasm.set_functions WHERE instanceid = instance_id
+    LOOP
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', generated_function.funcoid::regprocedure);
     END LOOP;
 
-    RETURN current_instance_id;
+    DELETE FROM wasm.aggregates WHERE instanceid = instance_id;
+    DELETE FROM wasm.set_functions WHERE instanceid = instance_id;
+    DELETE FROM wasm.exported_functions WHERE instanceid = instance_id;
+    DELETE FROM wasm.instances WHERE id = instance_id;
+    DELETE FROM wasm.modules WHERE hash NOT IN (SELECT module_hash FROM wasm.instances WHERE module_hash IS NOT NULL);
+
+    -- Every session releases its VMs of the instance on its next call.
+    PERFORM wasm_remove_instance(instance_id);
+END;
+$$ LANGUAGE plpgsql;
+
+-- Declare that an export takes or returns text or bytea, and generate its SQL function again.
+CREATE OR REPLACE FUNCTION wasm_declare_signature(instance_id int8, funcname text, inputs text, outputs text) RETURNS regprocedure AS $$
+DECLARE
+    exported_function RECORD;
+BEGIN
+    SELECT * INTO exported_function FROM wasm.exported_functions
+        WHERE instanceid = instance_id AND exported_functions.funcname = wasm_declare_signature.funcname;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'WebAssembly instance % does not export a function `%`.', instance_id, funcname;
+    END IF;
+
+    -- Checks the declaration against the export before anything is changed.
+    PERFORM wasm_declare_function(instance_id, funcname, inputs, outputs);
+
+    IF exported_function.funcoid IS NOT NULL THEN
+        EXECUTE format('DROP FUNCTION IF EXISTS %s;', exported_function.funcoid::regprocedure);
+    END IF;
+    UPDATE wasm.exported_functions SET inputs = wasm_declare_signature.inputs, outputs = wasm_declare_signature.outputs
+        WHERE instanceid = instance_id AND exported_functions.funcname = wasm_declare_signature.funcname;
+    RETURN wasm_generate_function(instance_id, exported_function.namespace, funcname, inputs, outputs);
+END;
+$$ LANGUAGE plpgsql;
+
+-- The generic entry points call any export through the session VM, so like volatile
+-- generated functions they run in the leader while the rest of the plan may be parallel.
+DO $$
+DECLARE
+    generic_function regprocedure;
+BEGIN
+    IF wasm_parallel_supported() THEN
+        FOR generic_function IN SELECT oid FROM pg_proc WHERE proname ~ '^wasm_invoke_(function(_[0-9]+)?|batch|array)$'
+        LOOP
+            EXECUTE format('ALTER FUNCTION %s PARALLEL RESTRICTED;', generic_function);
+        END LOOP;
+    END IF;
 END;
-$$ LANGUAGE plpgsql;
\ No newline at end of file
+$$;
@@ -2,569 +2,4867 @@
 #include "knl/knl_variable.h"
 #include "utils/builtins.h"
 #include "access/hash.h"
+#include "access/xact.h"
 #include "miscadmin.h"
 #include "funcapi.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#include "utils/resowner.h"
+#include "executor/spi.h"
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
 
+#include <openssl/sha.h>
 #include <wasmedge/wasmedge.h>
 
+#include "wasm_registry.h"
+
 PG_MODULE_MAGIC;
 
+extern "C" void _PG_init(void);
 extern "C" Datum wasm_create_instance(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_create_instance_from_bytes(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_module_hash(PG_FUNCTION_ARGS);
 extern "C" Datum wasm_get_instances(PG_FUNCTION_ARGS);
 extern "C" Datum wasm_get_exported_functions(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_0(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_1(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_2(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_3(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_4(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_5(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_6(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_7(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_8(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_9(PG_FUNCTION_ARGS);
-extern "C" Datum wasm_invoke_function_10(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_discard_cache(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_invoke_batch(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_invoke_array(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_bind_function(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_invoke_export(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_remove_instance(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_declare_function(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_aggregate_step(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_aggregate_combine(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_aggregate_final(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_invoke_srf(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_stat_functions(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_stat_instances(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_stat_reset(PG_FUNCTION_ARGS);
+extern "C" Datum wasm_invoke_function_variadic(PG_FUNCTION_ARGS);
 
 typedef struct TupleInstanceState {
     TupleDesc tupd;
-    std::map<int64, std::string>::iterator currindex;
-    std::map<int64, std::string>::iterator lastindex;
+    int64 *instanceids;
+    char **wasm_files;
+    int count;
+    int currindex;
 } TupleInstanceState;
 
+// As many as a SQL function takes
+#define MAX_PARAMS FUNC_MAX_ARGS
+// Arguments of the exports with an invoker specialized for their number
+#define WASM_SPECIALIZED_PARAMS 10
+// Results of a multi-value export, returned as the columns of a record
+#define MAX_RETURNS 16
+
+/*
+ * The arguments of one call: on the stack for up to WASM_SPECIALIZED_PARAMS of
+ * them, which is nearly every export, and from palloc for wider ones. An error
+ * leaves the latter to the memory context of the call.
+ */
+template <typename T>
+class WasmCallBuffer {
+public:
+    explicit WasmCallBuffer(size_t size)
+        : items(size <= WASM_SPECIALIZED_PARAMS ? inline_items : (T *)palloc(size * sizeof(T)))
+    {}
+    ~WasmCallBuffer()
+    {
+        if (items != inline_items) {
+            pfree(items);
+        }
+    }
+    T &operator[](size_t i)
+    {
+        return items[i];
+    }
+    T *data()
+    {
+        return items;
+    }
+
+private:
+    WasmCallBuffer(const WasmCallBuffer &);
+    WasmCallBuffer &operator=(const WasmCallBuffer &);
+
+    T inline_items[WASM_SPECIALIZED_PARAMS];
+    T *items;
+};
+
+/*
+ * Activity counters, kept for the whole server like the registry. They are only
+ * ever added to with relaxed atomics, and stay allocated once created so that call
+ * plans may point to them. Times are in nanoseconds and are only taken while
+ * wasm_executor.track_timing is on.
+ */
+#define WASM_STAT_BUCKETS 24
+
+typedef struct WasmFuncStats {
+    std::atomic<uint64> calls;
+    std::atomic<uint64> errors;
+    std::atomic<uint64> exec_time;
+    std::atomic<uint64> max_exec_time;
+    std::atomic<uint64> marshal_time; // copying text and bytea in and out, alloc and dealloc included
+    std::atomic<uint64> memo_hits; // calls answered by the result cache, which are not counted as calls
+    std::atomic<uint64> memo_misses;
+    // calls by exec time: bucket 0 is below 1 us, bucket i counts [2^(i-1), 2^i) us, the last one is open
+    std::atomic<uint64> histogram[WASM_STAT_BUCKETS];
+} __attribute__((aligned(WASM_CACHE_LINE_SIZE))) WasmFuncStats;
+
+typedef struct WasmInstanceStats {
+    std::atomic<uint64> loads; // module read and checked by create or rehydration
+    std::atomic<uint64> load_time;
+    std::atomic<uint64> compiles;
+    std::atomic<uint64> compile_time;
+    std::atomic<uint64> instantiations; // session VMs built
+    std::atomic<uint64> instantiate_time;
+    std::atomic<uint64> vm_hits; // call plans finding the session VM ready
+    std::atomic<uint64> vm_misses;
+    std::atomic<uint64> restores; // snapshots put back before a call
+    std::atomic<uint64> restore_time;
+    std::atomic<uint64> evictions; // idle session VMs released to stay within the memory limits
+    // what the instance holds right now over all sessions, not reset
+    std::atomic<uint64> vms;
+    std::atomic<uint64> memory; // bytes of linear memory and snapshots
+    pthread_mutex_t lock; // of functions, the counters themselves are atomic
+    std::map<std::string, WasmFuncStats*> functions;
+} WasmInstanceStats;
+
+// A copy of the counters of an export or an instance, as returned by the stat functions
+typedef struct WasmStatRow {
+    int64 instanceid;
+    char *funcname;
+    uint64 counters[13]; // in the order of the members of the stats
+    uint64 histogram[WASM_STAT_BUCKETS];
+} WasmStatRow;
+
+typedef struct TupleStatState {
+    TupleDesc tupd;
+    WasmStatRow *rows;
+    int count;
+    int currindex;
+} TupleStatState;
+
+/*
+ * How a SQL value crosses into the module. integer, bigint, real and double
+ * precision are passed as i32, i64, f32 and f64. text and bytea are copied into the
+ * linear memory and passed as (ptr i32, len i32); as a result they are returned as
+ * an i64 holding ptr in the high and len in the low 32 bits.
+ */
+typedef enum WasmValueKind {
+    WASM_VALUE_I32,
+    WASM_VALUE_I64,
+    WASM_VALUE_F32,
+    WASM_VALUE_F64,
+    WASM_VALUE_TEXT,
+    WASM_VALUE_BYTEA,
+    WASM_VALUE_VOID, // only as a result
+    WASM_VALUE_RECORD // only as a result, of several scalars
+} WasmValueKind;
+
+#define WASM_VALUE_IS_VARLENA(kind) ((kind) == WASM_VALUE_TEXT || (kind) == WASM_VALUE_BYTEA)
+#define WASM_VALUE_IS_INTEGER(kind) ((kind) == WASM_VALUE_I32 || (kind) == WASM_VALUE_I64)
+
 typedef struct WasmFuncInfo {
     std::string funcname;
     std::vector<std::string> inputs;
     std::string outputs;
+    // inputs and outputs encoded once by wasm_encode_signature, for the calls
+    uint32_t param_num;
+    std::vector<WasmValueKind> params;
+    WasmValueKind result;
+    uint32_t result_num;
+    WasmValueKind results[MAX_RETURNS]; // the scalars of a record result
 } WasmFuncInfo;
 
+/*
+ * Proposals beyond the MVP an instance is registered with. WasmEdge enables them
+ * all by default, an instance may leave some out.
+ */
+typedef enum WasmFeature {
+    WASM_FEATURE_SIMD = 1 << 0,
+    WASM_FEATURE_BULK_MEMORY = 1 << 1,
+    WASM_FEATURE_MULTI_VALUE = 1 << 2
+} WasmFeature;
+
+#define WASM_FEATURES_ALL (WASM_FEATURE_SIMD | WASM_FEATURE_BULK_MEMORY | WASM_FEATURE_MULTI_VALUE)
+
+// What a call of an instance finds in its VM
+typedef enum WasmIsolation {
+    WASM_ISOLATION_SHARED, // whatever the earlier calls of the session left
+    WASM_ISOLATION_SNAPSHOT // the state of right after instantiation, restored before every call
+} WasmIsolation;
+
+/*
+ * A module of wasm_executor.preload_modules, read, parsed and validated by the
+ * postmaster. The sessions are threads of the postmaster, so they all copy their VMs
+ * from this one parsed module. Built before any session starts and never changed.
+ */
+typedef struct WasmPreloadedModule {
+    std::string wasm_file; // canonical path
+    std::vector<uint8_t> bytes;
+    WasmEdge_ASTModuleContext *ast;
+    bool imports_wasi;
+    bool imports_host;
+} WasmPreloadedModule;
+
+/*
+ * A registered module, shared by all sessions of the server. An entry is complete
+ * when it is published and does not change afterwards, except that bytes are
+ * released under the shard lock of the instance when it is dropped.
+ */
+typedef struct WasmInstanceInfo {
+    int64 instanceid;
+    uint64 generation;
+    WasmIsolation isolation;
+    bool deterministic; // registered as immutable, so that results may be cached
+    uint32 features; // WasmFeature flags
+    std::string wasm_file;
+    std::vector<uint8_t> bytes;
+    const WasmPreloadedModule *preloaded; // when the bytes are the ones preloaded from wasm_file
+    std::vector<WasmFuncInfo *> functions; // in the order of the module
+    std::map<std::string, WasmFuncInfo *> function_index; // the same by name
+} WasmInstanceInfo;
+
 typedef struct TupleFuncState {
     TupleDesc tupd;
     std::vector<WasmFuncInfo*>::iterator currindex;
     std::vector<WasmFuncInfo*>::iterator lastindex;
 } TupleFuncState;
 
-#define BUF_LEN 256
-#define MAX_PARAMS 10
-#define MAX_RETURNS 1
-
-// Store the wasm file info globally 
-static std::map<int64, std::string> instances; 
-
-// Store the wasm exported function info globally
-static std::map<int64, std::vector<WasmFuncInfo *>*> exported_functions;
+/*
+ * The linear memory and the exported mutable globals of a VM right after it was
+ * instantiated. The memory image is kept in a memfd where the kernel has them, so
+ * that a large memory is restored by mapping the image copy-on-write over it: only
+ * the pages a call writes to are copied again. Smaller ones are simply copied back.
+ */
+typedef struct WasmVMSnapshot {
+    WasmEdge_MemoryInstanceContext *memory; // NULL when the module exports none
+    uint8_t *base; // of the linear memory when the snapshot was taken
+    size_t size;
+    int memfd; // -1 when the image is on the heap
+    uint8_t *image;
+    bool remap; // whether the image can be mapped over the memory
+    std::vector<WasmEdge_GlobalInstanceContext *> globals;
+    std::vector<WasmEdge_Value> global_values;
+    bool dirty; // a call ran since the last restore
+    uint64 epoch; // restores so far, aggregate and set states remember the one they started in
+} WasmVMSnapshot;
 
-static std::string find_wasm_file(int64 instanceid)
-{
-    std::map<int64, std::string>::iterator itor = instances.begin();
-    while (itor != instances.end()) {
-        if (itor->first == instanceid) {
-            return itor->second;
-        }
-        itor++;
-    }
-    elog(DEBUG1, "wasm_executor: not find instance info for instanceid %ld", instanceid);
-    return "";
-}
+/*
+ * A cursor a module opened through the host functions. Its portal outlives the
+ * SPI connection of the host call which opened it, so it is found again by name.
+ */
+typedef struct WasmHostCursor {
+    char portal_name[NAMEDATALEN];
+    std::vector<Oid> types; // of the columns
+    std::vector<WasmValueKind> kinds; // how the columns are written into the linear memory
+} WasmHostCursor;
 
-static std::vector<WasmFuncInfo*>* find_exported_func_list(int64 instanceid)
-{
-    std::map<int64, std::vector<WasmFuncInfo*>*>::iterator itor = exported_functions.begin();
-    while (itor != exported_functions.end()) {
-        if (itor->first == instanceid) {
-            return itor->second;
-        }
-        itor++;
-    }
-    elog(DEBUG1, "wasm_executor: not find exported func info for instanceid %ld", instanceid);
-    return NULL;
-}
+/*
+ * What the host functions of a VM share. They run in the middle of a call, where
+ * an error must not unwind through WasmEdge: it is kept here and raised once the
+ * call returned. Cursors only live for the call which opened them.
+ */
+typedef struct WasmHostState {
+    int64 instanceid;
+    std::vector<WasmHostCursor *> cursors; // by handle - 1, NULL once closed
+    ErrorData *error;
+    bool running; // a call of the VM is under way
+} WasmHostState;
 
-static WasmFuncInfo* find_exported_func(int64 instanceid, std::string funcname)
-{
-    std::vector<WasmFuncInfo *>* functions = find_exported_func_list(instanceid);
-    if (functions == NULL) {
-        ereport(ERROR, (errmsg("wasm_executor: function infos of instance %ld is not find", instanceid)));
-    }
-    for (std::vector<WasmFuncInfo*>::iterator curr = functions->begin(); curr != functions->end(); curr++) {
-        if ((*curr)->funcname == funcname) {
-            return *curr;
-        }
-    }
+/*
+ * A loaded, validated and instantiated module owned by the current session.
+ * Functions are run on it via WasmEdge_VMExecute.
+ */
+typedef struct WasmVMEntry {
+    int64 instanceid;
+    uint64 generation; // of the registry entry the VM was built from
+    uint64 serial; // unique in the session, tells a VM from a later one at the same address
+    WasmEdge_VMContext *vm;
+    WasmEdge_StatisticsContext *stat; // measures the cost of the calls against fuel_limit
+    WasmEdge_MemoryInstanceContext *memory; // exported linear memory, looked up on first use
+    WasmInstanceStats *stats;
+    WasmFuncStats *alloc_stats; // looked up on first use
+    WasmFuncStats *dealloc_stats;
+    WasmVMSnapshot *snapshot; // NULL unless the instance is isolated by snapshot
+    WasmEdge_MemoryInstanceContext *linear_memory; // whatever its export name, NULL without one
+    uint64 resident; // bytes accounted to the instance, the session and the server
+    uint64 last_used; // session_vm_clock of the last call, the smallest is evicted first
+    TimestampTz last_statement; // start of the statement of the last call, which keeps it from eviction
+    WasmEdge_ModuleInstanceContext *host_module; // NULL unless the module imports WASM_HOST_MODULE_NAME
+    WasmHostState *host;
+} WasmVMEntry;
 
-    ereport(ERROR, (errmsg("wasm_executor: function %s not exist in instance %ld ", funcname.c_str(), instanceid)));
-    return NULL;
-}
+// The export a generated SQL function is bound to
+typedef struct WasmFuncBinding {
+    int64 instanceid;
+    std::string funcname;
+} WasmFuncBinding;
 
-static int64 generate_uuid(Datum input) 
-{
-    Datum uuid = DirectFunctionCall1(hashtext, input);
-    return DatumGetInt64(uuid);
-}
+struct WasmCallPlan;
+typedef Datum (*WasmInvoker)(FunctionCallInfo fcinfo, struct WasmCallPlan *plan);
+typedef WasmEdge_Value (*WasmArgConverter)(Datum value);
 
-static int64 wasm_invoke_function(char *instanceid_str, char* funcname, std::vector<int64> &args)
-{
-    int64 instanceid = atol(instanceid_str);
-    std::string wasm_file = find_wasm_file(instanceid);
-    if (wasm_file == "") {
-        ereport(ERROR, (errmsg("wasm_executor: instance with id %ld is not find", instanceid)));
-    }
-    WasmFuncInfo *funcinfo = find_exported_func(instanceid, funcname);
+/*
+ * Everything a generated SQL function needs to dispatch a call, resolved on its
+ * first call and kept in flinfo->fn_extra. The plan is only valid as long as
+ * its VM is current, see wasm_session_vm_current, and registry_generation is.
+ */
+typedef struct WasmCallPlan {
+    uint64 session_generation;
+    uint64 vm_serial;
+    uint64 registry_generation;
+    int64 instanceid;
+    WasmFuncInfo *funcinfo;
+    WasmVMEntry *vm_entry;
+    WasmEdge_String wasm_func;
+    uint32_t param_num;
+    uint32_t wasm_param_num; // text and bytea take two
+    uint32_t return_num;
+    WasmValueKind *params; // inline_params, or in fn_mcxt for wider exports
+    WasmValueKind result;
+    TupleDesc tupdesc; // of a record result, built on its first call
+    WasmInvoker invoker; // specialized for the signature
+    WasmArgConverter *converters; // NULL for text and bytea
+    WasmFuncStats *stats;
+    bool memoize; // results go through the result cache of the session
+    WasmValueKind inline_params[WASM_SPECIALIZED_PARAMS];
+    WasmArgConverter inline_converters[WASM_SPECIALIZED_PARAMS];
+} WasmCallPlan;
 
-    WasmEdge_ConfigureContext *config_context = WasmEdge_ConfigureCreate();
-    WasmEdge_ConfigureAddHostRegistration(config_context, WasmEdge_HostRegistration_Wasi);
-    WasmEdge_VMContext *vm_conext = WasmEdge_VMCreate(config_context, NULL);
+// Entries of a set of the result cache, whose tags fill one cache line
+#define WASM_MEMO_WAYS 8
 
-    WasmEdge_Value params[args.size()];
-    for (unsigned int i = 0; i < args.size(); ++i) {
-        if (funcinfo->inputs[i] == "integer") {
-            params[i] = WasmEdge_ValueGenI32(args[i]);
-        } else {
-            params[i] = WasmEdge_ValueGenI64(args[i]);
-        }
-    }
+/*
+ * The cache of results of deterministic exports, by export and arguments. It is
+ * open addressed and set associative: a key hashes to a set of WASM_MEMO_WAYS
+ * entries, whose tags are scanned in one cache line, and a full set evicts by
+ * CLOCK, the hand giving every entry used since it last passed a second chance.
+ * Each session has its own, emptied whenever an instance is dropped or replaced.
+ */
+// Exports with more arguments are not cached
+#define WASM_MEMO_MAX_ARGS 10
 
-    WasmEdge_Value result[1];
-    WasmEdge_String wasm_func = WasmEdge_StringCreateByCString(funcname);
-    WasmEdge_Result ret = WasmEdge_VMRunWasmFromFile(vm_conext, wasm_file.c_str(), wasm_func, params, args.size(), result, 1);
-    if (!WasmEdge_ResultOK(ret)) {
-        WasmEdge_VMDelete(vm_conext);
-        WasmEdge_ConfigureDelete(config_context);
-        WasmEdge_StringDelete(wasm_func);
-        ereport(ERROR, (errmsg("wasm_executor: call func %s failed", funcname)));
-    } 
-    int64 ret_val = 0;
-    if (funcinfo->outputs == "integer") {
-        ret_val = WasmEdge_ValueGetI32(result[0]);
-    } else {
-        ret_val = WasmEdge_ValueGetI64(result[0]);
-    }
-    /* Resources deallocations. */
-    WasmEdge_VMDelete(vm_conext);
-    WasmEdge_ConfigureDelete(config_context);
-    WasmEdge_StringDelete(wasm_func);
+typedef struct WasmMemoEntry {
+    const WasmFuncInfo *funcinfo;
+    uint32_t nargs;
+    int64 args[WASM_MEMO_MAX_ARGS];
+    uint64 result;
+} WasmMemoEntry;
 
-    return ret_val;
-}
+typedef struct WasmMemoSet {
+    uint64 tags[WASM_MEMO_WAYS]; // hash of the key with the low bit set, 0 for a free entry
+} __attribute__((aligned(WASM_CACHE_LINE_SIZE))) WasmMemoSet;
 
-static void wasm_export_funcs_query(int64 instanceid, TupleFuncState* inter_call_data)
-{
-    std::string wasm_file = find_wasm_file(instanceid);
-    if (wasm_file == "") {
-        ereport(ERROR, (errmsg("wasm_executor: instance with id %ld is not find", instanceid)));
-    }
+typedef struct WasmMemoCache {
+    int size; // wasm_memo_cache_size it was built for
+    uint64 registry_generation; // the entries are valid for
+    bool sets_valid; // false until the tags are first cleared
+    uint32_t set_mask;
+    WasmMemoSet *sets;
+    WasmMemoEntry *entries; // WASM_MEMO_WAYS per set
+    uint8_t *referenced; // CLOCK bits, one byte per set
+    uint8_t *hands;
+} WasmMemoCache;
 
-    std::vector<WasmFuncInfo *>* functions = find_exported_func_list(instanceid);
-    if (functions != NULL) {
-        inter_call_data->currindex = functions->begin();
-        inter_call_data->lastindex = functions->end();
-        elog(DEBUG1, "wasm_executor:find exported func info for instanceid %ld", instanceid);
-        return;
-    }
+#define WASI_MODULE_NAME "wasi_snapshot_preview1"
+// Import module of the host functions through which a module reads tables
+#define WASM_HOST_MODULE_NAME "opengauss"
 
-    functions = new(std::nothrow)std::vector<WasmFuncInfo *>;
-    exported_functions.insert(std::pair<int64, std::vector<WasmFuncInfo *>*>(instanceid, functions));
-    
-    WasmEdge_StoreContext *store_cxt = WasmEdge_StoreCreate();
-    WasmEdge_VMContext *vm_cxt = WasmEdge_VMCreate(NULL, store_cxt);
+// Exports a module provides to receive data in its linear memory
+#define WASM_MEMORY_NAME "memory"
+#define WASM_ALLOC_FUNC "alloc"
+#define WASM_DEALLOC_FUNC "dealloc"
 
-    WasmEdge_VMLoadWasmFromFile(vm_cxt, wasm_file.c_str());
-    WasmEdge_VMValidate(vm_cxt);
-    WasmEdge_VMInstantiate(vm_cxt);
-    
-    WasmEdge_String func_name_list[BUF_LEN];
-    const WasmEdge_FunctionTypeContext *func_type_list[BUF_LEN];
-    /*
-     * If the list length is larger than the buffer length, the overflowed data
-     * will be discarded.
-     */
-    uint32_t rel_func_num = WasmEdge_VMGetFunctionList(vm_cxt, func_name_list, func_type_list, BUF_LEN);
-    for (unsigned int i = 0; i < rel_func_num && i < BUF_LEN; ++i) {
-        char tmp_buffer[BUF_LEN];
-        uint32_t func_name_len = WasmEdge_StringCopy(func_name_list[i], tmp_buffer, sizeof(tmp_buffer));
-        elog(DEBUG1, "wasm_executor: exported function string length: %u, name: %s\n", func_name_len, tmp_buffer);
-
-        uint32_t param_nums = WasmEdge_FunctionTypeGetParametersLength(func_type_list[i]);
-        if (param_nums > MAX_PARAMS) {
-            WasmEdge_StoreDelete(store_cxt);
-            WasmEdge_VMDelete(vm_cxt);
-            ereport(ERROR, (errmsg("wasm_executor: func %s has more than 10 params which not support", tmp_buffer)));
-        }
+// Name of the instances of modules kept in wasm.modules, followed by the hash of the bytes
+#define WASM_MODULE_HASH_PREFIX "sha256:"
 
-        uint32_t return_num = WasmEdge_FunctionTypeGetReturnsLength(func_type_list[i]);
-        if (return_num > MAX_RETURNS) {
-            WasmEdge_StoreDelete(store_cxt);
-            WasmEdge_VMDelete(vm_cxt);
-            ereport(ERROR, (errmsg("wasm_executor: func %s has more than 1 return value which not support", tmp_buffer)));
-        }
+// Compiled modules are kept in this directory, relative to the data directory
+#define WASM_AOT_CACHE_DIR "wasm_aot_cache"
+#define WASM_AOT_ARTIFACT_SUFFIX ".so"
 
-        WasmFuncInfo *funcinfo = new(std::nothrow)WasmFuncInfo();
+// How long an interruptible call is waited for before interrupts are checked, in ms
+#define WASM_INTERRUPT_POLL_MS 10
 
-        enum WasmEdge_ValType param_buffer[10]; // we allow max 10 parameters
-        param_nums = WasmEdge_FunctionTypeGetParameters(func_type_list[i], param_buffer, 10);
-        for (unsigned int j = 0; j < param_nums; ++j) {
-            if (param_buffer[j] == WasmEdge_ValType_I32) {
-                funcinfo->inputs.push_back("integer");
-            } else if (param_buffer[j] == WasmEdge_ValType_I64) {
-                funcinfo->inputs.push_back("bigint");
-            } else {
-                WasmEdge_StoreDelete(store_cxt);
-                WasmEdge_VMDelete(vm_cxt);
-                ereport(ERROR, (errmsg("wasm_executor: not support the value type(%d) for now", param_buffer[j])));
-            }
-        }
-        
-        return_num = WasmEdge_FunctionTypeGetReturns(func_type_list[i], param_buffer, 10);
-        if (param_buffer[0] == WasmEdge_ValType_I32) {
-            funcinfo->outputs = "integer";
-        } else if (param_buffer[0] == WasmEdge_ValType_I64) {
-            funcinfo->outputs = "bigint";
-        } else {
-            WasmEdge_StoreDelete(store_cxt);
-            WasmEdge_VMDelete(vm_cxt);
-            ereport(ERROR, (errmsg("wasm_executor: not support the value type(%d) for now", param_buffer[0])));
-        }
+// Run once after instantiation when exported, like WASI reactors expect
+#define WASM_INITIALIZE_FUNC "_initialize"
+#define WASM_PAGE_SIZE 65536
+// Smaller memories are restored by copying, which beats remapping and faulting the pages in
+#define WASM_SNAPSHOT_REMAP_SIZE (1024 * 1024)
 
-        funcinfo->funcname = std::string(tmp_buffer, func_name_len);
-        functions->push_back(funcinfo);
-    }
+typedef enum WasmExecutionMode {
+    WASM_EXEC_INTERPRETER,
+    WASM_EXEC_AOT,
+    WASM_EXEC_AUTO
+} WasmExecutionMode;
 
-    WasmEdge_StoreDelete(store_cxt);
-    WasmEdge_VMDelete(vm_cxt);
+static const struct config_enum_entry wasm_execution_mode_options[] = {
+    {"interpreter", WASM_EXEC_INTERPRETER, false},
+    {"aot", WASM_EXEC_AOT, false},
+    {"auto", WASM_EXEC_AUTO, false},
+    {NULL, 0, false}
+};
 
-    inter_call_data->currindex = functions->begin();
-    inter_call_data->lastindex = functions->end();
-    elog(DEBUG1, "wasm_executor:init exported func info for instanceid %ld", instanceid); 
-}
+static int wasm_execution_mode = WASM_EXEC_INTERPRETER;
 
-PG_FUNCTION_INFO_V1(wasm_create_instance);
-Datum wasm_create_instance(PG_FUNCTION_ARGS) 
-{
-    int64 uuid = generate_uuid(PG_GETARG_DATUM(0));
-    text *arg = PG_GETARG_TEXT_P(0);
-    char* filepath = text_to_cstring(arg);
-    canonicalize_path(filepath);
-    
-    if (!superuser())
-        ereport(ERROR,
-            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to create wasm instance"))));
+// Largest text or bytea passed into or returned from a module, in kB
+static int wasm_max_value_size = 16384;
 
-    std::string wasm_file = find_wasm_file(uuid);
-    if (wasm_file != "") {
-        ereport(NOTICE, (errmsg("wasm_executor: instance already created for %s", filepath)));
-        return UInt32GetDatum(uuid);
-    }
-    
-    WasmEdge_ConfigureContext *config_context = WasmEdge_ConfigureCreate();
-    WasmEdge_ConfigureAddHostRegistration(config_context, WasmEdge_HostRegistration_Wasi);
-    WasmEdge_VMContext *vm_cxt = WasmEdge_VMCreate(config_context, NULL);
+// Cost budget of a single call, in thousands of instructions; 0 means unlimited
+static int wasm_fuel_limit = 1000000;
 
-    WasmEdge_Result result = WasmEdge_VMLoadWasmFromFile(vm_cxt, filepath);
-    if (!WasmEdge_ResultOK(result)) {
-        WasmEdge_VMDelete(vm_cxt);
-        WasmEdge_ConfigureDelete(config_context);
-        ereport(ERROR, (errmsg("wasm_executor: failed to load %s", filepath)));
-    }
+// Whether calls run in a thread of their own so that the session can serve interrupts
+static bool wasm_interruptible = false;
 
-    result = WasmEdge_VMValidate(vm_cxt);
-    if (!WasmEdge_ResultOK(result)) {
-        WasmEdge_VMDelete(vm_cxt);
-        WasmEdge_ConfigureDelete(config_context);
-        ereport(ERROR, (errmsg("wasm_executor: wasm file validation failed %s", WasmEdge_ResultGetMessage(result))));
-    }
-    wasm_file = filepath;
-    instances.insert(std::pair<int64, std::string>(uuid, wasm_file));
+// Whether the activity counters include times, which costs reading the clock around every call
+static bool wasm_track_timing = true;
 
-    WasmEdge_VMDelete(vm_cxt);
-    WasmEdge_ConfigureDelete(config_context);
-    return Int64GetDatum(uuid);
-}
+// Size of the result cache of every session in kB, 0 turns it off
+static int wasm_memo_cache_size = 1024;
 
-PG_FUNCTION_INFO_V1(wasm_get_instances);
-Datum wasm_get_instances(PG_FUNCTION_ARGS) 
-{
-    FuncCallContext* fctx = NULL;
-    TupleInstanceState* inter_call_data = NULL;
-    if (SRF_IS_FIRSTCALL()) {
-        TupleDesc tupdesc;
-        MemoryContext mctx;
+// Largest linear memory of a VM, in wasm pages of 64 kB
+static int wasm_max_memory_pages = 65536;
 
-        fctx = SRF_FIRSTCALL_INIT();
-        mctx = MemoryContextSwitchTo(fctx->multi_call_memory_ctx);
-        inter_call_data = (TupleInstanceState*)palloc(sizeof(TupleInstanceState));
+// Memory of the VMs of a session and of the whole server in kB, beyond which idle VMs are released
+static int wasm_session_memory_limit = 0;
+static int wasm_total_memory_limit = 0;
 
-        /* Build a tuple descriptor for our result type */
-        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-            elog(ERROR, "wasm_executor: return type must be a row type");
+// Comma-separated paths of the modules to load at server start
+static char *wasm_preload_modules = NULL;
 
-        inter_call_data->tupd = tupdesc;
-        inter_call_data->currindex = instances.begin();
-        inter_call_data->lastindex = instances.end();
+/*
+ * The registry of instances. openGauss runs all sessions as threads of one process,
+ * so these are shared by every session; the catalog tables in the wasm schema are
+ * the persistent copy they are rehydrated from.
+ */
+static WasmShardedMap<int64, WasmInstanceInfo*> instances;
+// The generated SQL functions, by function oid
+static WasmShardedMap<Oid, WasmFuncBinding> function_bindings;
+// Dropped entries, which sessions may still refer to
+static pthread_mutex_t retired_instances_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<WasmInstanceInfo*> retired_instances;
+// Bumped whenever an instance is dropped, so that call plans resolve again
+static std::atomic<uint64> registry_generation(1);
+static std::atomic<uint64> next_instance_generation(1);
+// The activity counters by instance, entries removed on drop stay allocated
+static WasmShardedMap<int64, WasmInstanceStats*> instance_stats;
+// Bytes of linear memory and snapshots of all session VMs
+static std::atomic<uint64> total_vm_memory(0);
+// The modules of wasm_preload_modules by canonical path, only written by the postmaster
+static std::map<std::string, WasmPreloadedModule*> preloaded_modules;
 
-        fctx->user_fctx = inter_call_data;
-        MemoryContextSwitchTo(mctx);
-    }
+// Ready-to-run VMs of the current session, kept by the thread running it. Parallel workers
+// are threads too and build VMs of their own from the shared registry.
+static THR_LOCAL std::map<int64, WasmVMEntry*> *session_vms = NULL;
+static THR_LOCAL bool session_vms_cleanup_registered = false;
+/*
+ * The session the state of this thread belongs to. With enable_thread_pool a worker
+ * thread serves many sessions in turn, see wasm_attach_session.
+ */
+static THR_LOCAL bool session_vms_attached = false;
+static THR_LOCAL uint64 session_vms_owner = 0;
+// Changed whenever VMs of session_vms are released, so that call plans check whether it was theirs
+static THR_LOCAL uint64 session_vms_generation = 0;
+// Generations and VM serials are unique across threads, a plan or a state carried to another
+// worker thread by its session never takes a VM of that thread for its own
+static std::atomic<uint64> next_session_vms_generation(1);
+static std::atomic<uint64> next_vm_serial(1);
+// The registry_generation session_vms was last checked against
+static THR_LOCAL uint64 session_registry_generation = 0;
+// Bytes of linear memory and snapshots of session_vms
+static THR_LOCAL uint64 session_vm_memory = 0;
+// Counts the calls of the session, for the LRU order of its VMs
+static THR_LOCAL uint64 session_vm_clock = 0;
+// Results of deterministic exports, built on first use
+static THR_LOCAL WasmMemoCache *session_memo = NULL;
 
-    fctx = SRF_PERCALL_SETUP();
-    inter_call_data = (TupleInstanceState*)(fctx->user_fctx);
-    
-    if (inter_call_data->currindex != inter_call_data->lastindex) {
-        HeapTuple resultTuple;
-        Datum result;
-        Datum values[2];
-        bool nulls[2];
+static void wasm_memo_release();
+static void wasm_preload();
 
-        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
-        securec_check_c(rc, "\0", "\0");
+static inline void wasm_next_session_vms_generation()
+{
+    session_vms_generation = next_session_vms_generation.fetch_add(1, std::memory_order_relaxed);
+}
 
-        std::string wasm_file = inter_call_data->currindex->second;
-        values[0] = Int64GetDatum(inter_call_data->currindex->first);
-        values[1] = CStringGetTextDatum(wasm_file.c_str());
+void _PG_init(void)
+{
+    DefineCustomEnumVariable("wasm_executor.execution_mode",
+        "Selects how WebAssembly modules are executed.",
+        "interpreter runs the modules as they are, aot compiles them ahead of time and fails when "
+        "that is not possible, auto compiles them when possible and uses the interpreter otherwise.",
+        &wasm_execution_mode,
+        WASM_EXEC_INTERPRETER,
+        wasm_execution_mode_options,
+        PGC_SIGHUP,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-        /* Build and return the result tuple. */
-        resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
-        result = HeapTupleGetDatum(resultTuple);
+    DefineCustomIntVariable("wasm_executor.max_value_size",
+        "Sets the largest text or bytea value passed into or returned from a WebAssembly module.",
+        NULL,
+        &wasm_max_value_size,
+        16384,
+        1,
+        MAX_KILOBYTES,
+        PGC_SIGHUP,
+        GUC_UNIT_KB,
+        NULL,
+        NULL,
+        NULL);
 
-        inter_call_data->currindex++;
-        SRF_RETURN_NEXT(fctx, result);
-    } else {
-        SRF_RETURN_DONE(fctx);
-    }
-}
+    DefineCustomIntVariable("wasm_executor.fuel_limit",
+        "Sets the cost budget of a single call of a WebAssembly function, in thousands of instructions.",
+        "A call which runs out of its budget fails. 0 turns the limit off.",
+        &wasm_fuel_limit,
+        1000000,
+        0,
+        INT_MAX,
+        PGC_SIGHUP,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-PG_FUNCTION_INFO_V1(wasm_get_exported_functions);
-Datum wasm_get_exported_functions(PG_FUNCTION_ARGS) 
-{
-    int64 instanceid = PG_GETARG_INT64(0);
-    FuncCallContext* fctx = NULL;
-    TupleFuncState* inter_call_data = NULL;
-    if (SRF_IS_FIRSTCALL()) {
-        TupleDesc tupdesc;
-        MemoryContext mctx;
+    DefineCustomBoolVariable("wasm_executor.interruptible",
+        "Lets query cancel and statement_timeout interrupt running WebAssembly functions.",
+        "Every call then runs in a thread of its own while the session waits for it.",
+        &wasm_interruptible,
+        false,
+        PGC_SIGHUP,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-        fctx = SRF_FIRSTCALL_INIT();
-        mctx = MemoryContextSwitchTo(fctx->multi_call_memory_ctx);
-        inter_call_data = (TupleFuncState*)palloc(sizeof(TupleFuncState));
-        
-        /* Build a tuple descriptor for our result type */
-        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-            elog(ERROR, "wasm_executor: return type must be a row type");
+    DefineCustomBoolVariable("wasm_executor.track_timing",
+        "Collects the time spent loading, instantiating and running WebAssembly functions.",
+        "Calls and errors are counted either way.",
+        &wasm_track_timing,
+        true,
+        PGC_SIGHUP,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-        inter_call_data->tupd = tupdesc;
-        wasm_export_funcs_query(instanceid, inter_call_data);
+    DefineCustomIntVariable("wasm_executor.memo_cache_size",
+        "Sets the memory of the cache of every session for results of immutable WebAssembly functions.",
+        "Only instances registered as immutable use it. 0 turns the cache off.",
+        &wasm_memo_cache_size,
+        1024,
+        0,
+        MAX_KILOBYTES,
+        PGC_SIGHUP,
+        GUC_UNIT_KB,
+        NULL,
+        NULL,
+        NULL);
 
-        fctx->user_fctx = inter_call_data;
-        MemoryContextSwitchTo(mctx);
-    }
-    fctx = SRF_PERCALL_SETUP();
-    inter_call_data = (TupleFuncState*)(fctx->user_fctx);
-    
-    if (inter_call_data->currindex != inter_call_data->lastindex) {
-        HeapTuple resultTuple;
-        Datum result;
-        Datum values[3];
-        bool nulls[3];
+    DefineCustomIntVariable("wasm_executor.max_memory_pages",
+        "Sets the largest linear memory of a WebAssembly instance, in pages of 64 kB.",
+        "Memory growth beyond it fails. It applies to the VMs built afterwards.",
+        &wasm_max_memory_pages,
+        65536,
+        1,
+        65536,
+        PGC_SIGHUP,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
-        securec_check_c(rc, "\0", "\0");
+    DefineCustomIntVariable("wasm_executor.session_memory_limit",
+        "Sets the memory the WebAssembly VMs of a session may hold before idle ones are released.",
+        "VMs not used by the current statement are released least recently used first. 0 turns the limit off.",
+        &wasm_session_memory_limit,
+        0,
+        0,
+        MAX_KILOBYTES,
+        PGC_SIGHUP,
+        GUC_UNIT_KB,
+        NULL,
+        NULL,
+        NULL);
 
-        WasmFuncInfo *funcinfo = *inter_call_data->currindex;
-        values[0] = CStringGetTextDatum(funcinfo->funcname.c_str());
-        std::string inputs;
-        for (std::vector<std::string>::iterator curr = funcinfo->inputs.begin(); curr != funcinfo->inputs.end(); curr++) {
-            inputs += *curr;
-            inputs += ",";
-        }
-        if (inputs.length() > 0) {
-            inputs.pop_back();
-        }
-        values[1] = CStringGetTextDatum(inputs.c_str());
-        values[2] = CStringGetTextDatum(funcinfo->outputs.c_str());
+    DefineCustomIntVariable("wasm_executor.total_memory_limit",
+        "Sets the memory the WebAssembly VMs of all sessions may hold before sessions release idle ones.",
+        "Every session only releases its own VMs. 0 turns the limit off.",
+        &wasm_total_memory_limit,
+        0,
+        0,
+        MAX_KILOBYTES,
+        PGC_SIGHUP,
+        GUC_UNIT_KB,
+        NULL,
+        NULL,
+        NULL);
 
-        /* Build and return the result tuple. */
-        resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
-        result = HeapTupleGetDatum(resultTuple);
-        inter_call_data->currindex++;
+    DefineCustomStringVariable("wasm_executor.preload_modules",
+        "Lists the WebAssembly modules to load at server start.",
+        "Comma-separated absolute paths. The modules are read, validated and, unless execution_mode is "
+        "interpreter, compiled once by the postmaster when the library is in shared_preload_libraries.",
+        &wasm_preload_modules,
+        "",
+        PGC_POSTMASTER,
+        0,
+        NULL,
+        NULL,
+        NULL);
 
-        SRF_RETURN_NEXT(fctx, result);
-    } else {
-        SRF_RETURN_DONE(fctx);
+    if (process_shared_preload_libraries_in_progress) {
+        wasm_preload();
+    } else if (wasm_preload_modules != NULL && wasm_preload_modules[0] != '\0') {
+        elog(LOG, "wasm_executor: preload_modules is ignored unless wasm_executor is in shared_preload_libraries");
     }
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_0);
-Datum wasm_invoke_function_0(PG_FUNCTION_ARGS)
+static int64 generate_uuid(Datum input) 
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    Datum uuid = DirectFunctionCall1(hashtext, input);
+    return DatumGetInt64(uuid);
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_1);
-Datum wasm_invoke_function_1(PG_FUNCTION_ARGS)
+// Now in nanoseconds, or 0 when times are not collected
+static uint64 wasm_stat_clock()
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    if (!wasm_track_timing) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_2);
-Datum wasm_invoke_function_2(PG_FUNCTION_ARGS)
+static void wasm_stat_add_time(std::atomic<uint64> &counter, uint64 start)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    if (start != 0) {
+        counter.fetch_add(wasm_stat_clock() - start, std::memory_order_relaxed);
+    }
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_3);
-Datum wasm_invoke_function_3(PG_FUNCTION_ARGS)
+static WasmInstanceStats* wasm_instance_stats(int64 instanceid)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    WasmInstanceStats *stats = NULL;
+    if (instance_stats.lookup(instanceid, stats)) {
+        return stats;
+    }
+    WasmInstanceStats *created = new(std::nothrow)WasmInstanceStats();
+    if (created == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    pthread_mutex_init(&created->lock, NULL);
+    stats = created;
+    if (!instance_stats.insert(instanceid, stats)) {
+        pthread_mutex_destroy(&created->lock);
+        delete created; // another session was faster
+    }
+    return stats;
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_4);
-Datum wasm_invoke_function_4(PG_FUNCTION_ARGS)
+static WasmFuncStats* wasm_func_stats(WasmInstanceStats *stats, const std::string &funcname)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    WasmFuncStats *func_stats = NULL;
+    pthread_mutex_lock(&stats->lock);
+    std::map<std::string, WasmFuncStats*>::iterator itor = stats->functions.find(funcname);
+    if (itor != stats->functions.end()) {
+        func_stats = itor->second;
+    } else {
+        func_stats = new(std::nothrow)WasmFuncStats();
+        if (func_stats != NULL) {
+            stats->functions.insert(std::pair<std::string, WasmFuncStats*>(funcname, func_stats));
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+    if (func_stats == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    return func_stats;
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_5);
-Datum wasm_invoke_function_5(PG_FUNCTION_ARGS)
+// Count a successful call which started at start
+static void wasm_stat_count_call(WasmFuncStats *stats, uint64 start)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    stats->calls.fetch_add(1, std::memory_order_relaxed);
+    if (start == 0) {
+        return;
+    }
+    uint64 elapsed = wasm_stat_clock() - start;
+    stats->exec_time.fetch_add(elapsed, std::memory_order_relaxed);
+    uint64 max_time = stats->max_exec_time.load(std::memory_order_relaxed);
+    while (elapsed > max_time &&
+        !stats->max_exec_time.compare_exchange_weak(max_time, elapsed, std::memory_order_relaxed)) {
+    }
+    uint64 us = elapsed / 1000;
+    int bucket = (us == 0) ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= WASM_STAT_BUCKETS) {
+        bucket = WASM_STAT_BUCKETS - 1;
+    }
+    stats->histogram[bucket].fetch_add(1, std::memory_order_relaxed);
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_6);
-Datum wasm_invoke_function_6(PG_FUNCTION_ARGS)
+static void wasm_read_module_file(const char *wasm_file, std::vector<uint8_t> &bytes)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    params.push_back(PG_GETARG_INT64(7));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    FILE *file = AllocateFile(wasm_file, PG_BINARY_R);
+    if (file == NULL) {
+        ereport(ERROR, (errcode_for_file_access(), errmsg("wasm_executor: could not open file %s: %m", wasm_file)));
+    }
+
+    uint8_t buffer[BLCKSZ];
+    size_t read_len;
+    bytes.clear();
+    while ((read_len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + read_len);
+    }
+    if (ferror(file)) {
+        FreeFile(file);
+        ereport(ERROR, (errcode_for_file_access(), errmsg("wasm_executor: could not read file %s: %m", wasm_file)));
+    }
+    FreeFile(file);
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_7);
-Datum wasm_invoke_function_7(PG_FUNCTION_ARGS)
+static bool wasm_kind_of(const std::string &type, WasmValueKind *kind)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
-    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    params.push_back(PG_GETARG_INT64(7));
-    params.push_back(PG_GETARG_INT64(8));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    if (type == "integer") {
+        *kind = WASM_VALUE_I32;
+    } else if (type == "bigint") {
+        *kind = WASM_VALUE_I64;
+    } else if (type == "real") {
+        *kind = WASM_VALUE_F32;
+    } else if (type == "double precision") {
+        *kind = WASM_VALUE_F64;
+    } else if (type == "text") {
+        *kind = WASM_VALUE_TEXT;
+    } else if (type == "bytea") {
+        *kind = WASM_VALUE_BYTEA;
+    } else {
+        return false;
+    }
+    return true;
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_8);
-Datum wasm_invoke_function_8(PG_FUNCTION_ARGS)
+static Oid wasm_kind_type(WasmValueKind kind)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
+    switch (kind) {
+        case WASM_VALUE_I32:
+            return INT4OID;
+        case WASM_VALUE_I64:
+            return INT8OID;
+        case WASM_VALUE_F32:
+            return FLOAT4OID;
+        case WASM_VALUE_F64:
+            return FLOAT8OID;
+        case WASM_VALUE_TEXT:
+            return TEXTOID;
+        case WASM_VALUE_BYTEA:
+            return BYTEAOID;
+        case WASM_VALUE_RECORD:
+            return RECORDOID;
+        default:
+            return VOIDOID;
+    }
+}
+
+static void wasm_split_inputs(const char *inputs, std::vector<std::string> &types)
+{
+    std::string list = inputs;
+    size_t start = 0;
+    while (start < list.length()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.length();
+        }
+        types.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+/*
+ * Fill the compact signature of funcinfo from its type names. The outputs of a
+ * multi-value export are a list like the inputs, and make a record of scalars.
+ */
+static bool wasm_encode_signature(WasmFuncInfo *funcinfo)
+{
+    if (funcinfo->inputs.size() > MAX_PARAMS) {
+        return false;
+    }
+    funcinfo->param_num = funcinfo->inputs.size();
+    funcinfo->params.resize(funcinfo->param_num);
+    for (uint32_t i = 0; i < funcinfo->param_num; ++i) {
+        if (!wasm_kind_of(funcinfo->inputs[i], &funcinfo->params[i])) {
+            return false;
+        }
+    }
+    funcinfo->result = WASM_VALUE_VOID;
+    funcinfo->result_num = 0;
+    std::vector<std::string> outputs;
+    wasm_split_inputs(funcinfo->outputs.c_str(), outputs);
+    if (outputs.size() > MAX_RETURNS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < outputs.size(); ++i) {
+        if (!wasm_kind_of(outputs[i], &funcinfo->results[i]) ||
+            (outputs.size() > 1 && WASM_VALUE_IS_VARLENA(funcinfo->results[i]))) {
+            return false;
+        }
+    }
+    funcinfo->result_num = outputs.size();
+    if (funcinfo->result_num == 1) {
+        funcinfo->result = funcinfo->results[0];
+    } else if (funcinfo->result_num > 1) {
+        funcinfo->result = WASM_VALUE_RECORD;
+    }
+    return true;
+}
+
+static void wasm_free_instance_info(WasmInstanceInfo *info)
+{
+    for (std::vector<WasmFuncInfo*>::iterator curr = info->functions.begin(); curr != info->functions.end(); curr++) {
+        delete *curr;
+    }
+    delete info;
+}
+
+// Add an export to an entry not published yet, which then owns it
+static void wasm_add_function(WasmInstanceInfo *info, WasmFuncInfo *funcinfo)
+{
+    info->functions.push_back(funcinfo);
+    info->function_index[funcinfo->funcname] = funcinfo;
+}
+
+static WasmInstanceInfo* registry_lookup(int64 instanceid)
+{
+    WasmInstanceInfo *info = NULL;
+    (void)instances.lookup(instanceid, info);
+    return info;
+}
+
+/*
+ * Publish a complete entry. When another session registered the same instance in
+ * the meantime, that entry is kept and ours is thrown away.
+ */
+static WasmInstanceInfo* registry_publish(WasmInstanceInfo *info)
+{
+    WasmInstanceInfo *published = info;
+    if (!instances.insert(info->instanceid, published)) {
+        wasm_free_instance_info(info);
+    }
+    return published;
+}
+
+// Fails when the entry was dropped or replaced by another module since info was looked up
+static void wasm_check_instance_current(WasmInstanceInfo *info)
+{
+    bool current = false;
+    (void)instances.visit(info->instanceid, [&](WasmInstanceInfo *entry) {
+        current = (entry->generation == info->generation);
+    });
+
+    if (!current) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: instance with id %ld has been dropped", info->instanceid)));
+    }
+}
+
+static void copy_instance_bytes(WasmInstanceInfo *info, std::vector<uint8_t> &bytes)
+{
+    // the entry may be dropped meanwhile, which releases its bytes under the write lock
+    // or have its signatures redeclared, which keeps the generation of the module
+    (void)instances.visit(info->instanceid, [&](WasmInstanceInfo *current) {
+        if (current->generation == info->generation) {
+            bytes = current->bytes;
+        }
+    });
+
+    if (bytes.empty()) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: instance with id %ld has been dropped", info->instanceid)));
+    }
+}
+
+// The preloaded module of a path, when its bytes are still the ones given
+static const WasmPreloadedModule* wasm_find_preloaded(const char *path, const std::vector<uint8_t> *bytes)
+{
+    if (preloaded_modules.empty()) {
+        return NULL;
+    }
+    char *wasm_file = pstrdup(path);
+    canonicalize_path(wasm_file);
+    std::map<std::string, WasmPreloadedModule*>::const_iterator itor = preloaded_modules.find(wasm_file);
+    pfree(wasm_file);
+    if (itor == preloaded_modules.end() || (bytes != NULL && *bytes != itor->second->bytes)) {
+        return NULL;
+    }
+    return itor->second;
+}
+
+// The isolation as given to wasm_new_instance and kept in wasm.instances
+static WasmIsolation wasm_isolation_of(const char *name)
+{
+    if (strcmp(name, "shared") == 0) {
+        return WASM_ISOLATION_SHARED;
+    }
+    if (strcmp(name, "snapshot") != 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: isolation has to be shared or snapshot, not %s", name)));
+    }
+    return WASM_ISOLATION_SNAPSHOT;
+}
+
+static const struct {
+    const char *name;
+    WasmFeature feature;
+    enum WasmEdge_Proposal proposal;
+} wasm_feature_names[] = {
+    {"simd", WASM_FEATURE_SIMD, WasmEdge_Proposal_SIMD},
+    {"bulk_memory", WASM_FEATURE_BULK_MEMORY, WasmEdge_Proposal_BulkMemoryOperations},
+    {"multi_value", WASM_FEATURE_MULTI_VALUE, WasmEdge_Proposal_MultiValue}
+};
+
+#define WASM_FEATURE_COUNT (sizeof(wasm_feature_names) / sizeof(wasm_feature_names[0]))
+
+// The features as given to wasm_new_instance and kept in wasm.instances, a comma-separated list
+static uint32 wasm_features_of(const char *list)
+{
+    std::vector<std::string> names;
+    wasm_split_inputs(list, names);
+    uint32 features = 0;
+    for (std::vector<std::string>::iterator itor = names.begin(); itor != names.end(); itor++) {
+        size_t start = itor->find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            continue;
+        }
+        std::string name = itor->substr(start, itor->find_last_not_of(" \t") - start + 1);
+        size_t i = 0;
+        while (i < WASM_FEATURE_COUNT && name != wasm_feature_names[i].name) {
+            i++;
+        }
+        if (i == WASM_FEATURE_COUNT) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                errmsg("wasm_executor: unknown feature %s", name.c_str()),
+                errhint("The features are simd, bulk_memory and multi_value.")));
+        }
+        features |= wasm_feature_names[i].feature;
+    }
+    return features;
+}
+
+// A configuration with exactly the proposals among features the instance was registered with
+static WasmEdge_ConfigureContext* wasm_configure_create(uint32 features)
+{
+    WasmEdge_ConfigureContext *config_context = WasmEdge_ConfigureCreate();
+    for (size_t i = 0; i < WASM_FEATURE_COUNT; ++i) {
+        if ((features & wasm_feature_names[i].feature) != 0) {
+            WasmEdge_ConfigureAddProposal(config_context, wasm_feature_names[i].proposal);
+        } else {
+            WasmEdge_ConfigureRemoveProposal(config_context, wasm_feature_names[i].proposal);
+        }
+    }
+    // reference types build on the table instructions of bulk memory
+    if ((features & WASM_FEATURE_BULK_MEMORY) == 0) {
+        WasmEdge_ConfigureRemoveProposal(config_context, WasmEdge_Proposal_ReferenceTypes);
+    }
+    return config_context;
+}
+
+// A private copy of a published entry, to be changed and published by registry_replace
+static WasmInstanceInfo* wasm_copy_instance_info(WasmInstanceInfo *info)
+{
+    std::vector<uint8_t> bytes;
+    copy_instance_bytes(info, bytes);
+    WasmInstanceInfo *copy = new(std::nothrow)WasmInstanceInfo();
+    if (copy == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    copy->instanceid = info->instanceid;
+    copy->generation = info->generation;
+    copy->isolation = info->isolation;
+    copy->deterministic = info->deterministic;
+    copy->features = info->features;
+    copy->wasm_file = info->wasm_file;
+    copy->bytes.swap(bytes);
+    copy->preloaded = info->preloaded;
+    for (std::vector<WasmFuncInfo*>::iterator curr = info->functions.begin(); curr != info->functions.end(); curr++) {
+        WasmFuncInfo *funcinfo = new(std::nothrow)WasmFuncInfo(**curr);
+        if (funcinfo == NULL) {
+            wasm_free_instance_info(copy);
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+        wasm_add_function(copy, funcinfo);
+    }
+    return copy;
+}
+
+/*
+ * Publish a changed entry in place of the current one, which is retired. Sessions
+ * build their VM again when the generation of the entry changed.
+ */
+static void registry_replace(WasmInstanceInfo *info)
+{
+    WasmInstanceInfo *replaced = NULL;
+    if (!instances.replace(info->instanceid, info, [&](WasmInstanceInfo *current) {
+            std::vector<uint8_t>().swap(current->bytes);
+            replaced = current;
+        })) {
+        int64 instanceid = info->instanceid;
+        wasm_free_instance_info(info);
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: instance with id %ld has been dropped", instanceid)));
+    }
+    pthread_mutex_lock(&retired_instances_lock);
+    retired_instances.push_back(replaced);
+    pthread_mutex_unlock(&retired_instances_lock);
+    registry_generation++;
+}
+
+/*
+ * Rebuild the registry entry of an instance from the wasm.instances and
+ * wasm.exported_functions tables, e.g. after a restart. The export signatures are
+ * taken from the catalog, only the module bytes are read again.
+ */
+static WasmInstanceInfo* wasm_rehydrate_instance(int64 instanceid)
+{
+    Oid argtypes[1] = {INT8OID};
+    Datum values[1] = {Int64GetDatum(instanceid)};
+
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR, (errmsg("wasm_executor: SPI_connect failed")));
+    }
+    int ret = SPI_execute_with_args(
+        "SELECT wasm_file, isolation, volatility, module_hash, features FROM wasm.instances WHERE id = $1",
+        1, argtypes, values, NULL, true, 1);
+    if (ret != SPI_OK_SELECT || SPI_processed == 0) {
+        SPI_finish();
+        return NULL;
+    }
+    char *wasm_file = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+    char *isolation_name = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2);
+    char *volatility = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3);
+    char *module_hash = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4);
+    char *feature_names = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 5);
+    if (wasm_file == NULL && module_hash == NULL) {
+        SPI_finish();
+        return NULL;
+    }
+    WasmIsolation isolation = (isolation_name != NULL) ? wasm_isolation_of(isolation_name) : WASM_ISOLATION_SHARED;
+    uint32 features = (feature_names != NULL) ? wasm_features_of(feature_names) : WASM_FEATURES_ALL;
+
+    WasmInstanceInfo *info = new(std::nothrow)WasmInstanceInfo();
+    if (info == NULL) {
+        SPI_finish();
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    info->instanceid = instanceid;
+    info->wasm_file = (module_hash != NULL) ? std::string(WASM_MODULE_HASH_PREFIX) + module_hash : wasm_file;
+    info->isolation = isolation;
+    info->deterministic = (volatility != NULL && strcmp(volatility, "immutable") == 0);
+    info->features = features;
+
+    ret = SPI_execute_with_args("SELECT funcname, inputs, outputs FROM wasm.exported_functions WHERE instanceid = $1",
+        1, argtypes, values, NULL, true, 0);
+    if (ret != SPI_OK_SELECT) {
+        SPI_finish();
+        wasm_free_instance_info(info);
+        ereport(ERROR, (errmsg("wasm_executor: failed to read exported functions of instance %ld", instanceid)));
+    }
+    for (uint64 i = 0; i < SPI_processed; ++i) {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        char *funcname = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 1);
+        char *inputs = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 2);
+        char *outputs = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 3);
+        if (funcname == NULL) {
+            continue;
+        }
+        WasmFuncInfo *funcinfo = new(std::nothrow)WasmFuncInfo();
+        if (funcinfo == NULL) {
+            SPI_finish();
+            wasm_free_instance_info(info);
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+        funcinfo->funcname = funcname;
+        if (inputs != NULL) {
+            wasm_split_inputs(inputs, funcinfo->inputs);
+        }
+        funcinfo->outputs = (outputs != NULL) ? outputs : "";
+        wasm_add_function(info, funcinfo);
+        if (!wasm_encode_signature(funcinfo)) {
+            SPI_finish();
+            wasm_free_instance_info(info);
+            ereport(ERROR, (errmsg("wasm_executor: func %s of instance %ld has an unknown signature in the catalog",
+                funcname, instanceid)));
+        }
+    }
+    if (module_hash != NULL) {
+        // kept in the database, so that standbys find it without touching the file system
+        Oid hash_argtypes[1] = {TEXTOID};
+        Datum hash_values[1] = {CStringGetTextDatum(module_hash)};
+        WasmInstanceStats *stats = wasm_instance_stats(instanceid);
+        uint64 start = wasm_stat_clock();
+        ret = SPI_execute_with_args("SELECT bytes FROM wasm.modules WHERE hash = $1",
+            1, hash_argtypes, hash_values, NULL, true, 1);
+        bool isnull = true;
+        Datum module = (Datum)0;
+        if (ret == SPI_OK_SELECT && SPI_processed > 0) {
+            module = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+        }
+        if (isnull) {
+            SPI_finish();
+            wasm_free_instance_info(info);
+            ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+                errmsg("wasm_executor: module of instance %ld is missing from wasm.modules", instanceid)));
+        }
+        bytea *module_bytes = DatumGetByteaPP(module);
+        info->bytes.assign((uint8_t *)VARDATA_ANY(module_bytes),
+            (uint8_t *)VARDATA_ANY(module_bytes) + VARSIZE_ANY_EXHDR(module_bytes));
+        SPI_finish();
+        stats->loads.fetch_add(1, std::memory_order_relaxed);
+        wasm_stat_add_time(stats->load_time, start);
+        info->generation = next_instance_generation++;
+        elog(DEBUG1, "wasm_executor: rehydrated instance %ld from the catalog", instanceid);
+        return registry_publish(info);
+    }
+    SPI_finish();
+
+    // a preloaded module is taken as the server read it at start
+    info->preloaded = wasm_find_preloaded(info->wasm_file.c_str(), NULL);
+    if (info->preloaded != NULL) {
+        info->bytes = info->preloaded->bytes;
+    } else {
+        WasmInstanceStats *stats = wasm_instance_stats(instanceid);
+        uint64 start = wasm_stat_clock();
+        wasm_read_module_file(info->wasm_file.c_str(), info->bytes);
+        stats->loads.fetch_add(1, std::memory_order_relaxed);
+        wasm_stat_add_time(stats->load_time, start);
+    }
+    info->generation = next_instance_generation++;
+    elog(DEBUG1, "wasm_executor: rehydrated instance %ld from the catalog", instanceid);
+    return registry_publish(info);
+}
+
+static WasmInstanceInfo* find_instance(int64 instanceid)
+{
+    WasmInstanceInfo *info = registry_lookup(instanceid);
+    if (info == NULL) {
+        info = wasm_rehydrate_instance(instanceid);
+    }
+    if (info == NULL) {
+        ereport(ERROR, (errmsg("wasm_executor: instance with id %ld is not find", instanceid)));
+    }
+    return info;
+}
+
+static WasmFuncInfo* find_exported_func(WasmInstanceInfo *info, const std::string &funcname)
+{
+    std::map<std::string, WasmFuncInfo*>::const_iterator itor = info->function_index.find(funcname);
+    if (itor != info->function_index.end()) {
+        return itor->second;
+    }
+
+    ereport(ERROR, (errmsg("wasm_executor: function %s not exist in instance %ld ", funcname.c_str(), info->instanceid)));
+    return NULL;
+}
+
+// Look up the export a generated function is bound to, in the catalog after a restart
+static bool find_binding(Oid funcoid, WasmFuncBinding &binding)
+{
+    if (function_bindings.lookup(funcoid, binding)) {
+        return true;
+    }
+
+    bool found = false;
+
+    Oid argtypes[1] = {OIDOID};
+    Datum values[1] = {ObjectIdGetDatum(funcoid)};
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR, (errmsg("wasm_executor: SPI_connect failed")));
+    }
+    int ret = SPI_execute_with_args("SELECT instanceid, funcname FROM wasm.exported_functions WHERE funcoid = $1 "
+        "UNION ALL SELECT instanceid, aggname || '_step' FROM wasm.aggregates WHERE stepoid = $1 "
+        "UNION ALL SELECT instanceid, aggname || '_combine' FROM wasm.aggregates WHERE combineoid = $1 "
+        "UNION ALL SELECT instanceid, aggname || '_final' FROM wasm.aggregates WHERE finaloid = $1 "
+        "UNION ALL SELECT instanceid, funcname || '_open' FROM wasm.set_functions WHERE funcoid = $1",
+        1, argtypes, values, NULL, true, 1);
+    if (ret == SPI_OK_SELECT && SPI_processed > 0) {
+        char *instanceid = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+        char *funcname = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2);
+        if (instanceid != NULL && funcname != NULL) {
+            binding.instanceid = atol(instanceid);
+            binding.funcname = funcname;
+            found = true;
+        }
+    }
+    SPI_finish();
+
+    if (found) {
+        function_bindings.assign(funcoid, binding);
+    }
+    return found;
+}
+
+/*
+ * Everything which changes the generated code must be part of the artifact key,
+ * so that a new runtime, new options or other features never pick up an old artifact.
+ */
+static std::string wasm_aot_compiler_options(uint32 features)
+{
+    std::string options = "wasmedge-";
+    options += WasmEdge_VersionGet();
+    options += ";O3;native;interruptible;cost";
+    for (size_t i = 0; i < WASM_FEATURE_COUNT; ++i) {
+        if ((features & wasm_feature_names[i].feature) != 0) {
+            options += ";";
+            options += wasm_feature_names[i].name;
+        }
+    }
+    return options;
+}
+
+// The compiler has to accept exactly the proposals the VM loading the artifact accepts
+static WasmEdge_ConfigureContext* wasm_aot_compiler_config(uint32 features)
+{
+    WasmEdge_ConfigureContext *config_context = wasm_configure_create(features);
+    WasmEdge_ConfigureCompilerSetOptimizationLevel(config_context, WasmEdge_CompilerOptimizationLevel_O3);
+    WasmEdge_ConfigureCompilerSetOutputFormat(config_context, WasmEdge_CompilerOutputFormat_Native);
+    // compiled code has to check for cancellation and count the cost like the interpreter
+    WasmEdge_ConfigureCompilerSetInterruptible(config_context, true);
+    WasmEdge_ConfigureCompilerSetCostMeasuring(config_context, true);
+    return config_context;
+}
+
+// The SHA-256 of data followed by salt, in hex
+static std::string wasm_sha256_hex(const void *data, size_t size, const std::string &salt)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    SHA256_CTX sha_cxt;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+
+    SHA256_Init(&sha_cxt);
+    SHA256_Update(&sha_cxt, data, size);
+    SHA256_Update(&sha_cxt, salt.c_str(), salt.length());
+    SHA256_Final(digest, &sha_cxt);
+
+    std::string hex;
+    for (unsigned int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+        hex += hex_digits[digest[i] >> 4];
+        hex += hex_digits[digest[i] & 0x0F];
+    }
+    return hex;
+}
+
+static std::string wasm_aot_artifact_path(const std::vector<uint8_t> &bytes, uint32 features)
+{
+    return WASM_AOT_CACHE_DIR "/" + wasm_sha256_hex(bytes.data(), bytes.size(), wasm_aot_compiler_options(features)) +
+        WASM_AOT_ARTIFACT_SUFFIX;
+}
+
+/*
+ * Write the bytes of a module to a private file for the compiler, which only takes
+ * files. The bytes are the ones the artifact is named after, even when the module
+ * file changed since, or when the module is kept in wasm.modules.
+ */
+static bool wasm_aot_write_input(const char *path, const std::vector<uint8_t> &bytes, int elevel)
+{
+    FILE *file = AllocateFile(path, PG_BINARY_W);
+    if (file == NULL) {
+        ereport(elevel, (errcode_for_file_access(), errmsg("wasm_executor: could not create file %s: %m", path)));
+        return false;
+    }
+    if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+        FreeFile(file);
+        (void)unlink(path);
+        ereport(elevel, (errcode_for_file_access(), errmsg("wasm_executor: could not write file %s: %m", path)));
+        return false;
+    }
+    if (FreeFile(file) != 0) {
+        (void)unlink(path);
+        ereport(elevel, (errcode_for_file_access(), errmsg("wasm_executor: could not write file %s: %m", path)));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Compile the module into the artifact cache. The artifact is written to a private
+ * file first and renamed, so concurrent sessions never see a partial artifact.
+ * Failures are reported at elevel and make the caller stay with the interpreter.
+ */
+static bool wasm_aot_compile(const char *wasm_file, const std::vector<uint8_t> &bytes, uint32 features,
+    const std::string &artifact, int elevel, WasmInstanceStats *stats)
+{
+    if (mkdir(WASM_AOT_CACHE_DIR, S_IRWXU) != 0 && errno != EEXIST) {
+        ereport(elevel, (errcode_for_file_access(),
+            errmsg("wasm_executor: could not create directory %s: %m", WASM_AOT_CACHE_DIR)));
+        return false;
+    }
+
+    char tmp_path[MAXPGPATH];
+    errno_t rc = snprintf_s(tmp_path, sizeof(tmp_path), sizeof(tmp_path) - 1, "%s.%lu.tmp",
+        artifact.c_str(), (unsigned long)pthread_self());
+    securec_check_ss_c(rc, "\0", "\0");
+    char input_path[MAXPGPATH];
+    rc = snprintf_s(input_path, sizeof(input_path), sizeof(input_path) - 1, "%s.%lu.wasm",
+        artifact.c_str(), (unsigned long)pthread_self());
+    securec_check_ss_c(rc, "\0", "\0");
+    if (!wasm_aot_write_input(input_path, bytes, elevel)) {
+        return false;
+    }
+
+    uint64 start = wasm_stat_clock();
+    WasmEdge_ConfigureContext *config_context = wasm_aot_compiler_config(features);
+    WasmEdge_CompilerContext *compiler_cxt = WasmEdge_CompilerCreate(config_context);
+    WasmEdge_Result result = WasmEdge_CompilerCompile(compiler_cxt, input_path, tmp_path);
+    WasmEdge_CompilerDelete(compiler_cxt);
+    WasmEdge_ConfigureDelete(config_context);
+    (void)unlink(input_path);
+    stats->compiles.fetch_add(1, std::memory_order_relaxed);
+    wasm_stat_add_time(stats->compile_time, start);
+    if (!WasmEdge_ResultOK(result)) {
+        (void)unlink(tmp_path);
+        ereport(elevel, (errmsg("wasm_executor: failed to compile %s: %s", wasm_file, WasmEdge_ResultGetMessage(result))));
+        return false;
+    }
+
+    if (rename(tmp_path, artifact.c_str()) != 0) {
+        (void)unlink(tmp_path);
+        ereport(elevel, (errcode_for_file_access(),
+            errmsg("wasm_executor: could not rename file %s to %s: %m", tmp_path, artifact.c_str())));
+        return false;
+    }
+    elog(DEBUG1, "wasm_executor: compiled %s to %s", wasm_file, artifact.c_str());
+    return true;
+}
+
+/*
+ * Load the compiled artifact of the module into the VM, compiling it first when it
+ * is missing. Returns false when the caller has to fall back to the interpreter.
+ */
+static bool wasm_aot_load(WasmEdge_VMContext *vm_cxt, const std::string &wasm_file, const std::vector<uint8_t> &bytes,
+    uint32 features, WasmInstanceStats *stats)
+{
+    std::string artifact = wasm_aot_artifact_path(bytes, features);
+    if (access(artifact.c_str(), R_OK) != 0 &&
+        !wasm_aot_compile(wasm_file.c_str(), bytes, features, artifact, wasm_execution_mode == WASM_EXEC_AOT ? WARNING : DEBUG1,
+            stats)) {
+        return false;
+    }
+
+    WasmEdge_Result result = WasmEdge_VMLoadWasmFromFile(vm_cxt, artifact.c_str());
+    if (!WasmEdge_ResultOK(result)) {
+        // a stale or damaged artifact is dropped, the next session compiles a fresh one
+        (void)unlink(artifact.c_str());
+    } else {
+        /*
+         * The artifact is fine when the module itself does not validate or instantiate
+         * with the VM, so it is kept for the sessions which can use it.
+         */
+        result = WasmEdge_VMValidate(vm_cxt);
+        if (WasmEdge_ResultOK(result)) {
+            result = WasmEdge_VMInstantiate(vm_cxt);
+        }
+    }
+    if (!WasmEdge_ResultOK(result)) {
+        ereport(wasm_execution_mode == WASM_EXEC_AOT ? WARNING : DEBUG1,
+            (errmsg("wasm_executor: compiled artifact %s of %s is unusable, falling back to interpreter: %s",
+                artifact.c_str(), wasm_file.c_str(), WasmEdge_ResultGetMessage(result))));
+        return false;
+    }
+    return true;
+}
+
+// Whether the module imports anything from the import module of that name
+static bool wasm_module_imports(const WasmEdge_ASTModuleContext *ast_cxt, const char *module_name)
+{
+    uint32_t import_num = WasmEdge_ASTModuleListImportsLength(ast_cxt);
+    if (import_num == 0) {
+        return false;
+    }
+
+    std::vector<const WasmEdge_ImportTypeContext *> import_list(import_num);
+    import_num = WasmEdge_ASTModuleListImports(ast_cxt, import_list.data(), import_num);
+    WasmEdge_String name = WasmEdge_StringWrap(module_name, strlen(module_name));
+    for (unsigned int i = 0; i < import_num; ++i) {
+        if (WasmEdge_StringIsEqual(WasmEdge_ImportTypeGetModuleName(import_list[i]), name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read, parse and validate a module of preload_modules, and compile it when
+ * execution_mode asks for it. Failures are reported as warnings, so that a missing
+ * or broken module never keeps the server from starting; its instance is then
+ * loaded on first use as usual.
+ */
+static void wasm_preload_module(const char *path)
+{
+    char *wasm_file = pstrdup(path);
+    canonicalize_path(wasm_file);
+    if (!is_absolute_path(wasm_file)) {
+        ereport(WARNING, (errmsg("wasm_executor: preloaded module path %s is not absolute", wasm_file)));
+        return;
+    }
+    if (preloaded_modules.count(wasm_file) != 0) {
+        return;
+    }
+
+    WasmPreloadedModule *module = new(std::nothrow)WasmPreloadedModule();
+    if (module == NULL) {
+        ereport(WARNING, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        return;
+    }
+    module->wasm_file = wasm_file;
+    module->ast = NULL;
+
+    MemoryContext mctx = CurrentMemoryContext;
+    PG_TRY();
+    {
+        // the statistics go where the instance registered with this very path counts
+        WasmInstanceStats *stats = wasm_instance_stats(generate_uuid(CStringGetTextDatum(path)));
+        uint64 start = wasm_stat_clock();
+        wasm_read_module_file(wasm_file, module->bytes);
+        stats->loads.fetch_add(1, std::memory_order_relaxed);
+        wasm_stat_add_time(stats->load_time, start);
+
+        WasmEdge_ConfigureContext *config_context = WasmEdge_ConfigureCreate();
+        WasmEdge_LoaderContext *loader_cxt = WasmEdge_LoaderCreate(config_context);
+        WasmEdge_Result result = WasmEdge_LoaderParseFromBuffer(loader_cxt, &module->ast, module->bytes.data(),
+            module->bytes.size());
+        WasmEdge_LoaderDelete(loader_cxt);
+        if (WasmEdge_ResultOK(result)) {
+            WasmEdge_ValidatorContext *validator_cxt = WasmEdge_ValidatorCreate(config_context);
+            result = WasmEdge_ValidatorValidate(validator_cxt, module->ast);
+            WasmEdge_ValidatorDelete(validator_cxt);
+        }
+        WasmEdge_ConfigureDelete(config_context);
+        if (!WasmEdge_ResultOK(result)) {
+            ereport(ERROR, (errmsg("wasm_executor: wasm file validation failed %s", WasmEdge_ResultGetMessage(result))));
+        }
+        module->imports_wasi = wasm_module_imports(module->ast, WASI_MODULE_NAME);
+        module->imports_host = wasm_module_imports(module->ast, WASM_HOST_MODULE_NAME);
+
+        if (wasm_execution_mode != WASM_EXEC_INTERPRETER) {
+            // instances default to all features, so that is what they find compiled
+            std::string artifact = wasm_aot_artifact_path(module->bytes, WASM_FEATURES_ALL);
+            if (access(artifact.c_str(), R_OK) != 0) {
+                (void)wasm_aot_compile(wasm_file, module->bytes, WASM_FEATURES_ALL, artifact, WARNING, stats);
+            }
+        }
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(mctx);
+        ErrorData *edata = CopyErrorData();
+        FlushErrorState();
+        ereport(WARNING, (errmsg("wasm_executor: could not preload %s: %s", wasm_file, edata->message)));
+        FreeErrorData(edata);
+        if (module->ast != NULL) {
+            WasmEdge_ASTModuleDelete(module->ast);
+        }
+        delete module;
+        return;
+    }
+    PG_END_TRY();
+
+    preloaded_modules[module->wasm_file] = module;
+    elog(LOG, "wasm_executor: preloaded %s", wasm_file);
+}
+
+// Called by _PG_init in the postmaster, before any session exists
+static void wasm_preload()
+{
+    std::vector<std::string> paths;
+    if (wasm_preload_modules != NULL) {
+        wasm_split_inputs(wasm_preload_modules, paths);
+    }
+    for (std::vector<std::string>::iterator itor = paths.begin(); itor != paths.end(); itor++) {
+        size_t start = itor->find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            continue;
+        }
+        size_t end = itor->find_last_not_of(" \t");
+        wasm_preload_module(itor->substr(start, end - start + 1).c_str());
+    }
+}
+
+/*
+ * Host functions of WASM_HOST_MODULE_NAME, through which a module scans the result
+ * of a read-only query in batches instead of being called once per row:
+ *
+ *   cursor_open(query_ptr i32, query_len i32) -> i32               handle of the cursor
+ *   cursor_columns(handle i32, kinds_ptr i32, max i32) -> i32       number of columns
+ *   cursor_fetch(handle i32, max_rows i32, buf_ptr i32, buf_len i32) -> i32   rows, 0 at the end
+ *   cursor_close(handle i32)
+ *
+ * cursor_columns writes the kind of up to max columns as i32: 0 for i32 (integer,
+ * smallint and boolean), 1 for i64, 2 for f32 and 3 for f64. cursor_fetch writes
+ * the rows column by column, the values of a column followed by a byte per row
+ * which is 1 for a null, each padded to 8 bytes; it fetches as many rows as fit
+ * into the buffer. Every host call runs in a subtransaction of its own, so that an
+ * error is rolled back there and raised once the wasm call returned.
+ */
+#define WASM_HOST_PAD(size) (((size) + 7) & ~(size_t)7)
+#define WASM_HOST_MAX_PARAMS 4
+
+typedef void (*WasmHostBody)(WasmHostState *host, WasmEdge_MemoryInstanceContext *memory,
+    const WasmEdge_Value *params, WasmEdge_Value *returns);
+
+// Bytes of the linear memory of the calling module, which have to be within it
+static uint8_t* wasm_host_memory(WasmEdge_MemoryInstanceContext *memory, int32_t ptr, int32_t len)
+{
+    uint8_t *data = NULL;
+    if (memory != NULL && ptr >= 0 && len >= 0) {
+        data = WasmEdge_MemoryInstanceGetPointer(memory, (uint32_t)ptr, (uint32_t)len);
+    }
+    if (data == NULL) {
+        ereport(ERROR, (errmsg("wasm_executor: %d bytes at %d are out of the linear memory", len, ptr)));
+    }
+    return data;
+}
+
+static WasmHostCursor* wasm_host_cursor(WasmHostState *host, int32_t handle)
+{
+    if (handle <= 0 || (size_t)handle > host->cursors.size() || host->cursors[handle - 1] == NULL) {
+        ereport(ERROR, (errmsg("wasm_executor: instance %ld has no open cursor %d", host->instanceid, handle)));
+    }
+    return host->cursors[handle - 1];
+}
+
+static bool wasm_host_column_kind(Oid type, WasmValueKind *kind)
+{
+    switch (type) {
+        case BOOLOID:
+        case INT2OID:
+        case INT4OID:
+            *kind = WASM_VALUE_I32;
+            return true;
+        case INT8OID:
+            *kind = WASM_VALUE_I64;
+            return true;
+        case FLOAT4OID:
+            *kind = WASM_VALUE_F32;
+            return true;
+        case FLOAT8OID:
+            *kind = WASM_VALUE_F64;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void wasm_host_cursor_open(WasmHostState *host, WasmEdge_MemoryInstanceContext *memory,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    int32_t query_len = WasmEdge_ValueGetI32(params[1]);
+    const uint8_t *query_bytes = wasm_host_memory(memory, WasmEdge_ValueGetI32(params[0]), query_len);
+    char *query = pnstrdup((const char *)query_bytes, query_len);
+
+    // read_only also rejects queries which would write
+    Portal portal = SPI_cursor_open_with_args(NULL, query, 0, NULL, NULL, NULL, true, 0);
+    int natts = portal->tupDesc->natts;
+    if (natts == 0) {
+        ereport(ERROR, (errmsg("wasm_executor: a cursor of instance %ld has to return columns", host->instanceid)));
+    }
+    std::vector<Oid> types(natts);
+    std::vector<WasmValueKind> kinds(natts);
+    for (int i = 0; i < natts; ++i) {
+        types[i] = SPI_gettypeid(portal->tupDesc, i + 1);
+        if (!wasm_host_column_kind(types[i], &kinds[i])) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("wasm_executor: column %d of a cursor has type %s, which cannot be fetched into wasm",
+                    i + 1, format_type_be(types[i])),
+                errhint("Cast it to integer, bigint, real or double precision.")));
+        }
+    }
+
+    WasmHostCursor *cursor = new(std::nothrow)WasmHostCursor();
+    if (cursor == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    errno_t rc = strcpy_s(cursor->portal_name, NAMEDATALEN, portal->name);
+    securec_check(rc, "\0", "\0");
+    cursor->types.swap(types);
+    cursor->kinds.swap(kinds);
+    host->cursors.push_back(cursor);
+    returns[0] = WasmEdge_ValueGenI32((int32_t)host->cursors.size());
+}
+
+static void wasm_host_cursor_columns(WasmHostState *host, WasmEdge_MemoryInstanceContext *memory,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    WasmHostCursor *cursor = wasm_host_cursor(host, WasmEdge_ValueGetI32(params[0]));
+    int32_t ncolumns = (int32_t)cursor->kinds.size();
+    int32_t max = WasmEdge_ValueGetI32(params[2]);
+    if (max > 0) {
+        int32_t count = (max < ncolumns) ? max : ncolumns;
+        uint8_t *kinds = wasm_host_memory(memory, WasmEdge_ValueGetI32(params[1]), count * (int32_t)sizeof(int32_t));
+        for (int32_t i = 0; i < count; ++i) {
+            int32_t kind = (int32_t)cursor->kinds[i];
+            errno_t rc = memcpy_s(kinds + i * sizeof(int32_t), sizeof(int32_t), &kind, sizeof(int32_t));
+            securec_check(rc, "\0", "\0");
+        }
+    }
+    returns[0] = WasmEdge_ValueGenI32(ncolumns);
+}
+
+static size_t wasm_host_value_size(WasmValueKind kind)
+{
+    return (kind == WASM_VALUE_I64 || kind == WASM_VALUE_F64) ? sizeof(int64) : sizeof(int32);
+}
+
+/*
+ * Fetch the next rows of a cursor into the buffer. The batch is built in server
+ * memory, where every column starts aligned, and copied into the linear memory at
+ * once.
+ */
+static void wasm_host_cursor_fetch(WasmHostState *host, WasmEdge_MemoryInstanceContext *memory,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    WasmHostCursor *cursor = wasm_host_cursor(host, WasmEdge_ValueGetI32(params[0]));
+    int32_t max_rows = WasmEdge_ValueGetI32(params[1]);
+    int32_t buf_ptr = WasmEdge_ValueGetI32(params[2]);
+    int32_t buf_len = WasmEdge_ValueGetI32(params[3]);
+    (void)wasm_host_memory(memory, buf_ptr, buf_len);
+    if (max_rows <= 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: cursor_fetch needs a positive number of rows")));
+    }
+
+    // a row takes its values and a null byte per column, padding at most 7 bytes twice per column
+    size_t row_size = 0;
+    size_t padding = 0;
+    for (size_t c = 0; c < cursor->kinds.size(); ++c) {
+        row_size += wasm_host_value_size(cursor->kinds[c]) + 1;
+        padding += 14;
+    }
+    long rows = ((size_t)buf_len > padding) ? (long)(((size_t)buf_len - padding) / row_size) : 0;
+    if (rows > max_rows) {
+        rows = max_rows;
+    }
+    if (rows == 0) {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("wasm_executor: a buffer of %d bytes cannot hold a row of cursor %d",
+                buf_len, WasmEdge_ValueGetI32(params[0]))));
+    }
+
+    CHECK_FOR_INTERRUPTS();
+    Portal portal = SPI_cursor_find(cursor->portal_name);
+    if (portal == NULL) {
+        ereport(ERROR, (errmsg("wasm_executor: cursor %d of instance %ld is gone",
+            WasmEdge_ValueGetI32(params[0]), host->instanceid)));
+    }
+    SPI_cursor_fetch(portal, true, rows);
+    uint64 fetched = SPI_processed;
+    if (fetched > 0) {
+        size_t size = 0;
+        for (size_t c = 0; c < cursor->kinds.size(); ++c) {
+            size += WASM_HOST_PAD(fetched * wasm_host_value_size(cursor->kinds[c])) + WASM_HOST_PAD(fetched);
+        }
+        // zeroed, so that nulls and padding read as 0
+        uint8_t *batch = (uint8_t *)palloc0(size);
+        uint8_t *column = batch;
+        for (size_t c = 0; c < cursor->kinds.size(); ++c) {
+            uint8_t *nulls = column + WASM_HOST_PAD(fetched * wasm_host_value_size(cursor->kinds[c]));
+            for (uint64 r = 0; r < fetched; ++r) {
+                bool isnull = false;
+                Datum value = SPI_getbinval(SPI_tuptable->vals[r], SPI_tuptable->tupdesc, (int)c + 1, &isnull);
+                if (isnull) {
+                    nulls[r] = 1;
+                    continue;
+                }
+                switch (cursor->types[c]) {
+                    case BOOLOID:
+                        ((int32 *)column)[r] = DatumGetBool(value) ? 1 : 0;
+                        break;
+                    case INT2OID:
+                        ((int32 *)column)[r] = DatumGetInt16(value);
+                        break;
+                    case INT4OID:
+                        ((int32 *)column)[r] = DatumGetInt32(value);
+                        break;
+                    case INT8OID:
+                        ((int64 *)column)[r] = DatumGetInt64(value);
+                        break;
+                    case FLOAT4OID:
+                        ((float4 *)column)[r] = DatumGetFloat4(value);
+                        break;
+                    default:
+                        ((float8 *)column)[r] = DatumGetFloat8(value);
+                        break;
+                }
+            }
+            column = nulls + WASM_HOST_PAD(fetched);
+        }
+
+        // the linear memory may have moved while the query ran
+        uint8_t *buffer = wasm_host_memory(memory, buf_ptr, buf_len);
+        errno_t rc = memcpy_s(buffer, buf_len, batch, size);
+        securec_check(rc, "\0", "\0");
+        pfree(batch);
+    }
+    SPI_freetuptable(SPI_tuptable);
+    returns[0] = WasmEdge_ValueGenI32((int32_t)fetched);
+}
+
+static void wasm_host_cursor_close(WasmHostState *host, WasmEdge_MemoryInstanceContext *memory,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    int32_t handle = WasmEdge_ValueGetI32(params[0]);
+    WasmHostCursor *cursor = wasm_host_cursor(host, handle);
+    Portal portal = SPI_cursor_find(cursor->portal_name);
+    if (portal != NULL) {
+        SPI_cursor_close(portal);
+    }
+    host->cursors[handle - 1] = NULL;
+    delete cursor;
+}
+
+/*
+ * Run a host function in a subtransaction and an SPI connection of its own. An
+ * error must not unwind through the frames of WasmEdge: the subtransaction is
+ * rolled back, the error kept for wasm_vm_execute to raise, and the call trapped.
+ */
+template <WasmHostBody body>
+static WasmEdge_Result wasm_host_call(void *data, const WasmEdge_CallingFrameContext *frame,
+    const WasmEdge_Value *params, WasmEdge_Value *returns)
+{
+    WasmHostState *host = (WasmHostState *)data;
+    WasmEdge_MemoryInstanceContext *memory = WasmEdge_CallingFrameGetMemoryInstance(frame, 0);
+    MemoryContext mctx = CurrentMemoryContext;
+    ResourceOwner owner = CurrentResourceOwner;
+    bool failed = false;
+
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(mctx);
+    PG_TRY();
+    {
+        if (SPI_connect() != SPI_OK_CONNECT) {
+            ereport(ERROR, (errmsg("wasm_executor: SPI_connect failed")));
+        }
+        body(host, memory, params, returns);
+        SPI_finish();
+        ReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(mctx);
+        CurrentResourceOwner = owner;
+        SPI_restore_connection();
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(mctx);
+        ErrorData *edata = CopyErrorData();
+        FlushErrorState();
+        RollbackAndReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(mctx);
+        CurrentResourceOwner = owner;
+        SPI_restore_connection();
+        // a module going on after a failed host call only gets more errors, the first one is raised
+        if (host->error == NULL) {
+            host->error = edata;
+        } else {
+            FreeErrorData(edata);
+        }
+        failed = true;
+    }
+    PG_END_TRY();
+    return failed ? WasmEdge_Result_Fail : WasmEdge_Result_Success;
+}
+
+typedef struct WasmHostFunc {
+    const char *name;
+    WasmEdge_HostFunc_t func;
+    uint32_t param_num; // all i32
+    uint32_t return_num;
+} WasmHostFunc;
+
+static const WasmHostFunc wasm_host_funcs[] = {
+    {"cursor_open", wasm_host_call<wasm_host_cursor_open>, 2, 1},
+    {"cursor_columns", wasm_host_call<wasm_host_cursor_columns>, 3, 1},
+    {"cursor_fetch", wasm_host_call<wasm_host_cursor_fetch>, 4, 1},
+    {"cursor_close", wasm_host_call<wasm_host_cursor_close>, 1, 0}
+};
+
+// The import module of the host functions, bound to the state of one VM
+static WasmEdge_ModuleInstanceContext* wasm_host_module_create(WasmHostState *host)
+{
+    WasmEdge_ModuleInstanceContext *module_cxt = WasmEdge_ModuleInstanceCreate(
+        WasmEdge_StringWrap(WASM_HOST_MODULE_NAME, strlen(WASM_HOST_MODULE_NAME)));
+    if (module_cxt == NULL) {
+        return NULL;
+    }
+    enum WasmEdge_ValType types[WASM_HOST_MAX_PARAMS];
+    for (int i = 0; i < WASM_HOST_MAX_PARAMS; ++i) {
+        types[i] = WasmEdge_ValType_I32;
+    }
+    for (size_t i = 0; i < sizeof(wasm_host_funcs) / sizeof(wasm_host_funcs[0]); ++i) {
+        const WasmHostFunc *def = &wasm_host_funcs[i];
+        WasmEdge_FunctionTypeContext *type_cxt = WasmEdge_FunctionTypeCreate(types, def->param_num, types,
+            def->return_num);
+        WasmEdge_FunctionInstanceContext *func_cxt = WasmEdge_FunctionInstanceCreate(type_cxt, def->func, host, 0);
+        WasmEdge_FunctionTypeDelete(type_cxt);
+        if (func_cxt == NULL) {
+            WasmEdge_ModuleInstanceDelete(module_cxt);
+            return NULL;
+        }
+        WasmEdge_ModuleInstanceAddFunction(module_cxt, WasmEdge_StringWrap(def->name, strlen(def->name)), func_cxt);
+    }
+    return module_cxt;
+}
+
+// Close the cursors a call left open and hand over the error of its host calls
+static ErrorData* wasm_host_end_call(WasmHostState *host)
+{
+    for (size_t i = 0; i < host->cursors.size(); ++i) {
+        WasmHostCursor *cursor = host->cursors[i];
+        if (cursor == NULL) {
+            continue;
+        }
+        Portal portal = SPI_cursor_find(cursor->portal_name);
+        if (portal != NULL) {
+            SPI_cursor_close(portal);
+        }
+        delete cursor;
+    }
+    host->cursors.clear();
+    host->running = false;
+    ErrorData *error = host->error;
+    host->error = NULL;
+    return error;
+}
+
+// After the VM the host module was registered with
+static void wasm_host_free(WasmHostState *host, WasmEdge_ModuleInstanceContext *host_module)
+{
+    if (host_module != NULL) {
+        WasmEdge_ModuleInstanceDelete(host_module);
+    }
+    if (host == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < host->cursors.size(); ++i) {
+        delete host->cursors[i];
+    }
+    delete host;
+}
+
+static inline bool wasm_vm_running(const WasmVMEntry *entry)
+{
+    return entry->host != NULL && entry->host->running;
+}
+
+// A reader of the sections of a module binary, which was validated before
+struct WasmBinaryReader {
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+static bool wasm_read_byte(WasmBinaryReader *reader, uint8_t *value)
+{
+    if (reader->pos >= reader->end) {
+        return false;
+    }
+    *value = *reader->pos++;
+    return true;
+}
+
+// An unsigned or signed LEB128 of at most 64 bits, only u32 values are kept
+static bool wasm_read_leb(WasmBinaryReader *reader, uint32 *value)
+{
+    uint64 result = 0;
+    uint8_t byte;
+    for (unsigned int shift = 0; shift < 70; shift += 7) {
+        if (!wasm_read_byte(reader, &byte)) {
+            return false;
+        }
+        if (shift < 64) {
+            result |= (uint64)(byte & 0x7F) << shift;
+        }
+        if ((byte & 0x80) == 0) {
+            *value = (uint32)result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool wasm_skip_bytes(WasmBinaryReader *reader, size_t size)
+{
+    if ((size_t)(reader->end - reader->pos) < size) {
+        return false;
+    }
+    reader->pos += size;
+    return true;
+}
+
+static bool wasm_skip_name(WasmBinaryReader *reader)
+{
+    uint32 length;
+    return wasm_read_leb(reader, &length) && wasm_skip_bytes(reader, length);
+}
+
+static bool wasm_skip_limits(WasmBinaryReader *reader)
+{
+    uint8_t flags;
+    uint32 value;
+    return wasm_read_byte(reader, &flags) && wasm_read_leb(reader, &value) &&
+        ((flags & 0x01) == 0 || wasm_read_leb(reader, &value));
+}
+
+// The constant expression initializing a global, up to and including its end
+static bool wasm_skip_const_expr(WasmBinaryReader *reader)
+{
+    uint8_t opcode;
+    uint32 value;
+    while (wasm_read_byte(reader, &opcode)) {
+        switch (opcode) {
+            case 0x0B: // end
+                return true;
+            case 0x41: // i32.const
+            case 0x42: // i64.const
+            case 0x23: // global.get
+            case 0xD2: // ref.func
+                if (!wasm_read_leb(reader, &value)) {
+                    return false;
+                }
+                break;
+            case 0x43: // f32.const
+                if (!wasm_skip_bytes(reader, 4)) {
+                    return false;
+                }
+                break;
+            case 0x44: // f64.const
+                if (!wasm_skip_bytes(reader, 8)) {
+                    return false;
+                }
+                break;
+            case 0xD0: // ref.null
+                if (!wasm_skip_bytes(reader, 1)) {
+                    return false;
+                }
+                break;
+            case 0xFD: // v128.const
+                if (!wasm_read_leb(reader, &value) || !wasm_skip_bytes(reader, 16)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * The number of mutable globals, imported or defined, which the module does not
+ * export, such as the stack pointer of clang and rustc. WasmEdge only reaches
+ * globals by their export names, so a snapshot cannot put these back. Returns -1
+ * when the sections cannot be read.
+ */
+static int wasm_hidden_mutable_globals(const std::vector<uint8_t> &bytes)
+{
+    WasmBinaryReader reader = {bytes.data(), bytes.data() + bytes.size()};
+    std::vector<bool> mutable_globals;
+    std::vector<bool> exported_globals;
+
+    // the magic number and the version
+    if (!wasm_skip_bytes(&reader, 8)) {
+        return -1;
+    }
+    uint8_t id;
+    while (wasm_read_byte(&reader, &id)) {
+        uint32 size;
+        if (!wasm_read_leb(&reader, &size) || (size_t)(reader.end - reader.pos) < size) {
+            return -1;
+        }
+        WasmBinaryReader section = {reader.pos, reader.pos + size};
+        reader.pos += size;
+        if (id != 2 && id != 6 && id != 7) {
+            continue;
+        }
+
+        uint32 count;
+        if (!wasm_read_leb(&section, &count)) {
+            return -1;
+        }
+        for (uint32 i = 0; i < count; ++i) {
+            uint8_t kind;
+            uint8_t byte;
+            uint32 index;
+            if (id == 2) {
+                // imports: module, name, kind and description; globals come first in the index space
+                if (!wasm_skip_name(&section) || !wasm_skip_name(&section) || !wasm_read_byte(&section, &kind)) {
+                    return -1;
+                }
+                bool ok = false;
+                switch (kind) {
+                    case 0x00: // function
+                        ok = wasm_read_leb(&section, &index);
+                        break;
+                    case 0x01: // table
+                        ok = wasm_read_byte(&section, &byte) && wasm_skip_limits(&section);
+                        break;
+                    case 0x02: // memory
+                        ok = wasm_skip_limits(&section);
+                        break;
+                    case 0x03: // global
+                        ok = wasm_read_byte(&section, &byte) && wasm_read_byte(&section, &byte);
+                        mutable_globals.push_back(byte == 0x01);
+                        break;
+                    default:
+                        break;
+                }
+                if (!ok) {
+                    return -1;
+                }
+            } else if (id == 6) {
+                // globals: value type, mutability and initializer
+                if (!wasm_read_byte(&section, &byte) || !wasm_read_byte(&section, &byte)) {
+                    return -1;
+                }
+                mutable_globals.push_back(byte == 0x01);
+                if (!wasm_skip_const_expr(&section)) {
+                    return -1;
+                }
+            } else {
+                // exports: name, kind and index
+                if (!wasm_skip_name(&section) || !wasm_read_byte(&section, &kind) ||
+                    !wasm_read_leb(&section, &index)) {
+                    return -1;
+                }
+                if (kind == 0x03) {
+                    if (index >= exported_globals.size()) {
+                        exported_globals.resize(index + 1, false);
+                    }
+                    exported_globals[index] = true;
+                }
+            }
+        }
+    }
+
+    int hidden = 0;
+    for (size_t i = 0; i < mutable_globals.size(); ++i) {
+        if (mutable_globals[i] && (i >= exported_globals.size() || !exported_globals[i])) {
+            hidden++;
+        }
+    }
+    return hidden;
+}
+
+/*
+ * Snapshot isolation only restores what the module exports, so an entry not
+ * published yet whose module keeps state in a mutable global it does not export
+ * is freed and refused.
+ */
+static void wasm_check_snapshot_globals(WasmInstanceInfo *info)
+{
+    if (info->isolation != WASM_ISOLATION_SNAPSHOT) {
+        return;
+    }
+    int hidden = wasm_hidden_mutable_globals(info->bytes);
+    if (hidden == 0) {
+        return;
+    }
+    std::string wasm_file = info->wasm_file;
+    wasm_free_instance_info(info);
+    if (hidden < 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: could not read the globals of %s for snapshot isolation", wasm_file.c_str())));
+    }
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+        errmsg("wasm_executor: snapshot isolation cannot restore the %d mutable globals %s does not export",
+            hidden, wasm_file.c_str()),
+        errhint("Export every mutable global of the module, such as the stack pointer, or use shared isolation.")));
+}
+
+static void wasm_free_snapshot(WasmVMSnapshot *snapshot)
+{
+    if (snapshot->memfd >= 0) {
+        (void)munmap(snapshot->image, snapshot->size);
+        (void)close(snapshot->memfd);
+    } else {
+        free(snapshot->image);
+    }
+    delete snapshot;
+}
+
+// Keep the image of the memory in a memfd mapped read-only, or on the heap without memfd
+static bool wasm_snapshot_store_image(WasmVMSnapshot *snapshot)
+{
+#ifdef SYS_memfd_create
+    snapshot->memfd = (int)syscall(SYS_memfd_create, "wasm_snapshot", 0);
+    if (snapshot->memfd >= 0) {
+        size_t written = 0;
+        while (written < snapshot->size) {
+            ssize_t nwritten = write(snapshot->memfd, snapshot->base + written, snapshot->size - written);
+            if (nwritten < 0 && errno == EINTR) {
+                continue;
+            }
+            if (nwritten <= 0) {
+                break;
+            }
+            written += nwritten;
+        }
+        if (written == snapshot->size) {
+            void *image = mmap(NULL, snapshot->size, PROT_READ, MAP_SHARED, snapshot->memfd, 0);
+            if (image != MAP_FAILED) {
+                snapshot->image = (uint8_t *)image;
+                return true;
+            }
+        }
+        (void)close(snapshot->memfd);
+        snapshot->memfd = -1;
+    }
+#endif
+    snapshot->image = (uint8_t *)malloc(snapshot->size);
+    return snapshot->image != NULL &&
+        memcpy_s(snapshot->image, snapshot->size, snapshot->base, snapshot->size) == EOK;
+}
+
+/*
+ * Take the snapshot of a VM which was just instantiated. Only what the module
+ * exports can be reached, the linear memory and the exported globals, which is
+ * why wasm_check_snapshot_globals refuses modules with other mutable globals.
+ * Returns NULL when there is no memory for it.
+ */
+static WasmVMSnapshot* wasm_take_snapshot(WasmEdge_VMContext *vm_cxt)
+{
+    WasmVMSnapshot *snapshot = new(std::nothrow)WasmVMSnapshot();
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->memfd = -1;
+    const WasmEdge_ModuleInstanceContext *module_cxt = WasmEdge_VMGetActiveModule(vm_cxt);
+
+    // a module has one memory at most, under whatever name it exports it
+    WasmEdge_String name;
+    if (WasmEdge_ModuleInstanceListMemory(module_cxt, &name, 1) >= 1) {
+        snapshot->memory = WasmEdge_ModuleInstanceFindMemory(module_cxt, name);
+    }
+    if (snapshot->memory != NULL) {
+        snapshot->size = (size_t)WasmEdge_MemoryInstanceGetPageSize(snapshot->memory) * WASM_PAGE_SIZE;
+    }
+    if (snapshot->size > 0) {
+        snapshot->base = WasmEdge_MemoryInstanceGetPointer(snapshot->memory, 0, 1);
+        if (!wasm_snapshot_store_image(snapshot)) {
+            wasm_free_snapshot(snapshot);
+            return NULL;
+        }
+        snapshot->remap = snapshot->memfd >= 0 && snapshot->size >= WASM_SNAPSHOT_REMAP_SIZE &&
+            ((uintptr_t)snapshot->base % (uintptr_t)getpagesize()) == 0;
+    }
+
+    uint32_t global_num = WasmEdge_ModuleInstanceListGlobalLength(module_cxt);
+    std::vector<WasmEdge_String> names(global_num);
+    global_num = WasmEdge_ModuleInstanceListGlobal(module_cxt, names.data(), global_num);
+    for (uint32_t i = 0; i < global_num; ++i) {
+        WasmEdge_GlobalInstanceContext *global = WasmEdge_ModuleInstanceFindGlobal(module_cxt, names[i]);
+        if (global != NULL &&
+            WasmEdge_GlobalTypeGetMutability(WasmEdge_GlobalInstanceGetGlobalType(global)) == WasmEdge_Mutability_Var) {
+            snapshot->globals.push_back(global);
+            snapshot->global_values.push_back(WasmEdge_GlobalInstanceGetValue(global));
+        }
+    }
+    return snapshot;
+}
+
+static void wasm_free_vm_entry(WasmVMEntry *entry)
+{
+    entry->stats->vms.fetch_sub(1, std::memory_order_relaxed);
+    entry->stats->memory.fetch_sub(entry->resident, std::memory_order_relaxed);
+    total_vm_memory.fetch_sub(entry->resident, std::memory_order_relaxed);
+    session_vm_memory -= entry->resident;
+    WasmEdge_VMDelete(entry->vm);
+    wasm_host_free(entry->host, entry->host_module);
+    if (entry->snapshot != NULL) {
+        wasm_free_snapshot(entry->snapshot);
+    }
+    delete entry;
+}
+
+// Bring what the VM holds up to date, linear memory only grows during calls
+static void wasm_vm_account(WasmVMEntry *vm_entry)
+{
+    uint64 resident = 0;
+    if (vm_entry->linear_memory != NULL) {
+        resident = (uint64)WasmEdge_MemoryInstanceGetPageSize(vm_entry->linear_memory) * WASM_PAGE_SIZE;
+    }
+    if (vm_entry->snapshot != NULL) {
+        resident += vm_entry->snapshot->size;
+    }
+    if (resident == vm_entry->resident) {
+        return;
+    }
+    // unsigned, so that adding the difference also takes a shrink off
+    uint64 delta = resident - vm_entry->resident;
+    vm_entry->stats->memory.fetch_add(delta, std::memory_order_relaxed);
+    total_vm_memory.fetch_add(delta, std::memory_order_relaxed);
+    session_vm_memory += delta;
+    vm_entry->resident = resident;
+}
+
+static bool wasm_session_memory_exceeded()
+{
+    return wasm_session_memory_limit > 0 && session_vm_memory > (uint64)wasm_session_memory_limit * 1024;
+}
+
+static bool wasm_total_memory_exceeded(uint64 freed)
+{
+    return wasm_total_memory_limit > 0 &&
+        total_vm_memory.load(std::memory_order_relaxed) - freed > (uint64)wasm_total_memory_limit * 1024;
+}
+
+// The idle VM of the session used least recently, end() when all are used by the current statement
+static std::map<int64, WasmVMEntry*>::iterator wasm_eviction_victim(TimestampTz statement)
+{
+    std::map<int64, WasmVMEntry*>::iterator victim = session_vms->end();
+    for (std::map<int64, WasmVMEntry*>::iterator itor = session_vms->begin(); itor != session_vms->end(); itor++) {
+        if (itor->second->last_statement != statement &&
+            (victim == session_vms->end() || itor->second->last_used < victim->second->last_used)) {
+            victim = itor;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Release idle VMs of the session, least recently used first, until it is back
+ * within the memory limits. A VM used by the current statement may hold the
+ * state of an aggregate or a set-returning function, so it is never released;
+ * session_memory_limit is exceeded rather than failing a call. The VMs of other
+ * sessions count towards total_memory_limit too, so the session only releases
+ * its own when that brings the total back within the limit, and returns false
+ * when even releasing all of them would not: then the VM just built is refused.
+ */
+static bool wasm_evict_session_vms()
+{
+    TimestampTz statement = GetCurrentStatementStartTimestamp();
+    bool total_exceeded = wasm_total_memory_exceeded(0);
+    if (total_exceeded) {
+        uint64 idle = 0;
+        for (std::map<int64, WasmVMEntry*>::iterator itor = session_vms->begin(); itor != session_vms->end(); itor++) {
+            if (itor->second->last_statement != statement) {
+                idle += itor->second->resident;
+            }
+        }
+        if (wasm_total_memory_exceeded(idle)) {
+            return false;
+        }
+    }
+
+    while (wasm_session_memory_exceeded() || (total_exceeded && wasm_total_memory_exceeded(0))) {
+        std::map<int64, WasmVMEntry*>::iterator victim = wasm_eviction_victim(statement);
+        if (victim == session_vms->end()) {
+            break;
+        }
+        elog(DEBUG1, "wasm_executor: released the idle VM of instance %ld holding %lu bytes",
+            victim->first, (unsigned long)victim->second->resident);
+        victim->second->stats->evictions.fetch_add(1, std::memory_order_relaxed);
+        wasm_free_vm_entry(victim->second);
+        session_vms->erase(victim);
+        wasm_next_session_vms_generation();
+    }
+    return true;
+}
+
+static void wasm_release_session_vms(int code, Datum arg)
+{
+    wasm_memo_release();
+    if (session_vms == NULL) {
+        return;
+    }
+
+    // a VM whose call runs the current query through its host functions stays
+    std::map<int64, WasmVMEntry*>::iterator itor = session_vms->begin();
+    while (itor != session_vms->end()) {
+        if (wasm_vm_running(itor->second)) {
+            itor++;
+            continue;
+        }
+        wasm_free_vm_entry(itor->second);
+        session_vms->erase(itor++);
+    }
+    wasm_next_session_vms_generation();
+}
+
+// Release the VMs of instances which have been dropped or registered again since
+static void wasm_sweep_session_vms()
+{
+    std::map<int64, WasmVMEntry*>::iterator itor = session_vms->begin();
+    while (itor != session_vms->end()) {
+        WasmInstanceInfo *info = registry_lookup(itor->first);
+        if ((info != NULL && info->generation == itor->second->generation) || wasm_vm_running(itor->second)) {
+            itor++;
+            continue;
+        }
+        wasm_free_vm_entry(itor->second);
+        session_vms->erase(itor++);
+        wasm_next_session_vms_generation();
+    }
+}
+
+/*
+ * Make the VMs and the result cache of this thread those of the session it runs.
+ * With enable_thread_pool the sessions move between worker threads, and the
+ * linear memory, globals and cached results one session left must not be seen by
+ * the next, so they are released when the thread serves another session. Sessions
+ * only move between statements, when none of the VMs is running.
+ */
+static void wasm_attach_session()
+{
+    uint64 session_id = u_sess->session_id;
+    if (session_vms_attached && session_vms_owner == session_id) {
+        return;
+    }
+    if (session_vms_attached) {
+        elog(DEBUG1, "wasm_executor: session %lu takes the thread over from session %lu, releasing its VMs",
+            (unsigned long)session_id, (unsigned long)session_vms_owner);
+        wasm_release_session_vms(0, 0);
+    }
+    wasm_next_session_vms_generation();
+    session_vms_owner = session_id;
+    session_vms_attached = true;
+}
+
+/*
+ * Load, validate and instantiate the module once for the current session. WASI and
+ * the host functions are only registered when the module really imports them.
+ * Unless execution_mode is interpreter, the compiled artifact is used when it can
+ * be loaded.
+ */
+static WasmVMEntry* wasm_build_session_vm(WasmInstanceInfo *info)
+{
+    const std::string &wasm_file = info->wasm_file;
+    const WasmPreloadedModule *preloaded = info->preloaded;
+    WasmInstanceStats *stats = wasm_instance_stats(info->instanceid);
+    uint64 start = wasm_stat_clock();
+    std::vector<uint8_t> copied_bytes;
+    WasmEdge_ASTModuleContext *ast_cxt = NULL;
+    WasmEdge_Result result = WasmEdge_Result_Success;
+
+    WasmEdge_ConfigureContext *config_context = wasm_configure_create(info->features);
+    if (preloaded != NULL) {
+        // parsed once by the postmaster, the VM gets its own copy
+        wasm_check_instance_current(info);
+    } else {
+        copy_instance_bytes(info, copied_bytes);
+        WasmEdge_LoaderContext *loader_cxt = WasmEdge_LoaderCreate(config_context);
+        result = WasmEdge_LoaderParseFromBuffer(loader_cxt, &ast_cxt, copied_bytes.data(), copied_bytes.size());
+        WasmEdge_LoaderDelete(loader_cxt);
+        if (!WasmEdge_ResultOK(result)) {
+            WasmEdge_ConfigureDelete(config_context);
+            ereport(ERROR, (errmsg("wasm_executor: failed to load %s", wasm_file.c_str())));
+        }
+    }
+    const std::vector<uint8_t> &bytes = (preloaded != NULL) ? preloaded->bytes : copied_bytes;
+    const WasmEdge_ASTModuleContext *module_ast = (preloaded != NULL) ? preloaded->ast : ast_cxt;
+
+    if ((preloaded != NULL) ? preloaded->imports_wasi : wasm_module_imports(ast_cxt, WASI_MODULE_NAME)) {
+        WasmEdge_ConfigureAddHostRegistration(config_context, WasmEdge_HostRegistration_Wasi);
+    }
+    WasmEdge_ConfigureStatisticsSetCostMeasuring(config_context, true);
+    WasmEdge_ConfigureSetMaxMemoryPage(config_context, (uint32_t)wasm_max_memory_pages);
+    WasmEdge_VMContext *vm_cxt = WasmEdge_VMCreate(config_context, NULL);
+    WasmEdge_ConfigureDelete(config_context);
+
+    WasmHostState *host = NULL;
+    WasmEdge_ModuleInstanceContext *host_module = NULL;
+    if ((preloaded != NULL) ? preloaded->imports_host : wasm_module_imports(ast_cxt, WASM_HOST_MODULE_NAME)) {
+        host = new(std::nothrow)WasmHostState();
+        host_module = (host != NULL) ? wasm_host_module_create(host) : NULL;
+        if (host_module == NULL || !WasmEdge_ResultOK(WasmEdge_VMRegisterModuleFromImport(vm_cxt, host_module))) {
+            WasmEdge_VMDelete(vm_cxt);
+            wasm_host_free(host, host_module);
+            if (ast_cxt != NULL) {
+                WasmEdge_ASTModuleDelete(ast_cxt);
+            }
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                errmsg("wasm_executor: out of memory for the host functions of %s", wasm_file.c_str())));
+        }
+        host->instanceid = info->instanceid;
+        host->error = NULL;
+        host->running = false;
+    }
+
+    if (wasm_execution_mode != WASM_EXEC_INTERPRETER && wasm_aot_load(vm_cxt, wasm_file, bytes, info->features, stats)) {
+        result = WasmEdge_Result_Success;
+    } else {
+        result = WasmEdge_VMLoadWasmFromASTModule(vm_cxt, module_ast);
+        if (WasmEdge_ResultOK(result)) {
+            result = WasmEdge_VMValidate(vm_cxt);
+        }
+        if (WasmEdge_ResultOK(result)) {
+            result = WasmEdge_VMInstantiate(vm_cxt);
+        }
+    }
+    if (ast_cxt != NULL) {
+        WasmEdge_ASTModuleDelete(ast_cxt);
+    }
+    WasmEdge_String initialize_func = WasmEdge_StringWrap(WASM_INITIALIZE_FUNC, strlen(WASM_INITIALIZE_FUNC));
+    ErrorData *host_error = NULL;
+    if (WasmEdge_ResultOK(result) && WasmEdge_VMGetFunctionType(vm_cxt, initialize_func) != NULL) {
+        if (host != NULL) {
+            host->running = true;
+        }
+        result = WasmEdge_VMExecute(vm_cxt, initialize_func, NULL, 0, NULL, 0);
+        if (host != NULL) {
+            host_error = wasm_host_end_call(host);
+        }
+    }
+    if (!WasmEdge_ResultOK(result)) {
+        WasmEdge_VMDelete(vm_cxt);
+        wasm_host_free(host, host_module);
+        if (host_error != NULL) {
+            ReThrowError(host_error);
+        }
+        ereport(ERROR, (errmsg("wasm_executor: failed to instantiate %s: %s",
+            wasm_file.c_str(), WasmEdge_ResultGetMessage(result))));
+    }
+
+    WasmVMEntry *entry = new(std::nothrow)WasmVMEntry();
+    if (entry == NULL) {
+        WasmEdge_VMDelete(vm_cxt);
+        wasm_host_free(host, host_module);
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    entry->instanceid = info->instanceid;
+    entry->generation = info->generation;
+    entry->serial = next_vm_serial.fetch_add(1, std::memory_order_relaxed);
+    entry->vm = vm_cxt;
+    entry->stat = WasmEdge_VMGetStatisticsContext(vm_cxt);
+    entry->memory = NULL;
+    entry->stats = stats;
+    entry->alloc_stats = NULL;
+    entry->dealloc_stats = NULL;
+    entry->snapshot = NULL;
+    entry->linear_memory = NULL;
+    entry->resident = 0;
+    entry->last_used = session_vm_clock;
+    entry->last_statement = GetCurrentStatementStartTimestamp();
+    entry->host_module = host_module;
+    entry->host = host;
+    stats->vms.fetch_add(1, std::memory_order_relaxed);
+    // a module has one memory at most, under whatever name it exports it
+    WasmEdge_String memory_name;
+    const WasmEdge_ModuleInstanceContext *module_cxt = WasmEdge_VMGetActiveModule(vm_cxt);
+    if (WasmEdge_ModuleInstanceListMemory(module_cxt, &memory_name, 1) >= 1) {
+        entry->linear_memory = WasmEdge_ModuleInstanceFindMemory(module_cxt, memory_name);
+    }
+    if (info->isolation == WASM_ISOLATION_SNAPSHOT) {
+        entry->snapshot = wasm_take_snapshot(vm_cxt);
+        if (entry->snapshot == NULL) {
+            wasm_free_vm_entry(entry);
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                errmsg("wasm_executor: out of memory for the snapshot of %s", wasm_file.c_str())));
+        }
+    }
+    wasm_vm_account(entry);
+    stats->instantiations.fetch_add(1, std::memory_order_relaxed);
+    wasm_stat_add_time(stats->instantiate_time, start);
+    elog(DEBUG1, "wasm_executor: instantiated %s for instanceid %ld", wasm_file.c_str(), info->instanceid);
+    return entry;
+}
+
+static WasmVMEntry* wasm_get_session_vm(WasmInstanceInfo *info)
+{
+    wasm_attach_session();
+    if (session_vms == NULL) {
+        session_vms = new(std::nothrow)std::map<int64, WasmVMEntry*>;
+        if (session_vms == NULL) {
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+    }
+    if (!session_vms_cleanup_registered) {
+        on_proc_exit(wasm_release_session_vms, 0);
+        session_vms_cleanup_registered = true;
+    }
+
+    uint64 current_registry_generation = registry_generation.load();
+    if (session_registry_generation != current_registry_generation) {
+        wasm_sweep_session_vms();
+        session_registry_generation = current_registry_generation;
+    }
+
+    std::map<int64, WasmVMEntry*>::iterator itor = session_vms->find(info->instanceid);
+    if (itor != session_vms->end() && wasm_vm_running(itor->second)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("wasm_executor: instance %ld cannot be called by a query it runs", info->instanceid)));
+    }
+    if (itor != session_vms->end() && itor->second->generation == info->generation) {
+        itor->second->stats->vm_hits.fetch_add(1, std::memory_order_relaxed);
+        itor->second->last_statement = GetCurrentStatementStartTimestamp();
+        return itor->second;
+    }
+    wasm_instance_stats(info->instanceid)->vm_misses.fetch_add(1, std::memory_order_relaxed);
+    if (itor != session_vms->end()) {
+        wasm_free_vm_entry(itor->second);
+        session_vms->erase(itor);
+        wasm_next_session_vms_generation();
+    }
+
+    WasmVMEntry *entry = wasm_build_session_vm(info);
+    session_vms->insert(std::pair<int64, WasmVMEntry*>(info->instanceid, entry));
+    if (!wasm_evict_session_vms()) {
+        session_vms->erase(info->instanceid);
+        wasm_free_vm_entry(entry);
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("wasm_executor: no VM of instance %ld, the VMs of all sessions exceed total_memory_limit",
+                info->instanceid),
+            errhint("Raise wasm_executor.total_memory_limit, or retry once other sessions released their VMs.")));
+    }
+    return entry;
+}
+
+// Release a VM whose state cannot be trusted any more, the next call builds it again
+static void wasm_forget_session_vm(WasmVMEntry *vm_entry)
+{
+    session_vms->erase(vm_entry->instanceid);
+    wasm_free_vm_entry(vm_entry);
+    wasm_next_session_vms_generation();
+}
+
+/*
+ * Whether the VM a plan or a state was made for is still the session VM of its
+ * instance. Only when some VM of the session was released since generation is
+ * it looked up, by the serial because the address may have been reused, and
+ * generation is brought up to date when it is still there. The VM is not
+ * touched when it is gone.
+ */
+static bool wasm_session_vm_current(int64 instanceid, const WasmVMEntry *vm_entry, uint64 serial, uint64 *generation)
+{
+    if (*generation == session_vms_generation) {
+        return true;
+    }
+    if (session_vms == NULL) {
+        return false;
+    }
+    std::map<int64, WasmVMEntry*>::iterator itor = session_vms->find(instanceid);
+    if (itor == session_vms->end() || itor->second != vm_entry || itor->second->serial != serial) {
+        return false;
+    }
+    *generation = session_vms_generation;
+    return true;
+}
+
+/*
+ * Put the memory and the globals back as they were right after instantiation. The
+ * part the memory grew by since is zeroed, it cannot shrink again.
+ */
+static void wasm_snapshot_restore(WasmVMEntry *vm_entry)
+{
+    WasmVMSnapshot *snapshot = vm_entry->snapshot;
+    uint64 start = wasm_stat_clock();
+    if (snapshot->size > 0) {
+        size_t size = (size_t)WasmEdge_MemoryInstanceGetPageSize(snapshot->memory) * WASM_PAGE_SIZE;
+        uint8_t *base = WasmEdge_MemoryInstanceGetPointer(snapshot->memory, 0, 1);
+        bool remap = snapshot->remap && base == snapshot->base;
+        if (remap && mmap(base, snapshot->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            snapshot->memfd, 0) == MAP_FAILED) {
+            // a failed fixed mapping may have unmapped the memory already
+            int64 instanceid = vm_entry->instanceid;
+            wasm_forget_session_vm(vm_entry);
+            ereport(ERROR, (errmsg("wasm_executor: failed to restore the snapshot of instance %ld: %m", instanceid)));
+        }
+        if (!remap) {
+            errno_t rc = memcpy_s(base, snapshot->size, snapshot->image, snapshot->size);
+            securec_check(rc, "\0", "\0");
+        }
+        if (size > snapshot->size && (!remap || madvise(base + snapshot->size, size - snapshot->size, MADV_DONTNEED) != 0)) {
+            errno_t rc = memset_s(base + snapshot->size, size - snapshot->size, 0, size - snapshot->size);
+            securec_check(rc, "\0", "\0");
+        }
+    }
+    for (size_t i = 0; i < snapshot->globals.size(); ++i) {
+        WasmEdge_GlobalInstanceSetValue(snapshot->globals[i], snapshot->global_values[i]);
+    }
+    snapshot->dirty = false;
+    snapshot->epoch++;
+    vm_entry->stats->restores.fetch_add(1, std::memory_order_relaxed);
+    wasm_stat_add_time(vm_entry->stats->restore_time, start);
+}
+
+/*
+ * Start a call of an instance. A call isolated by snapshot starts from the state of
+ * right after instantiation, unless it carries on an aggregate or a set whose state
+ * lives in the memory (reset is false). Returns the epoch of the snapshot, which
+ * such a state keeps to notice a restore in between.
+ */
+static inline uint64 wasm_vm_begin_call(WasmVMEntry *vm_entry, bool reset)
+{
+    vm_entry->last_used = ++session_vm_clock;
+    vm_entry->last_statement = GetCurrentStatementStartTimestamp();
+    WasmVMSnapshot *snapshot = vm_entry->snapshot;
+    if (snapshot == NULL) {
+        return 0;
+    }
+    if (reset && snapshot->dirty) {
+        wasm_snapshot_restore(vm_entry);
+    }
+    snapshot->dirty = true;
+    return snapshot->epoch;
+}
+
+static inline uint64 wasm_vm_epoch(WasmVMEntry *vm_entry)
+{
+    return (vm_entry->snapshot != NULL) ? vm_entry->snapshot->epoch : 0;
+}
+
+/*
+ * Run the call in a thread of WasmEdge and wait for it in slices, serving the
+ * interrupts of the session in between: query cancel and statement_timeout are
+ * only raised in the session thread. The call is cancelled and waited for before
+ * the error propagates, so the VM is idle again when the session goes on.
+ */
+static WasmEdge_Result wasm_vm_execute_interruptible(WasmVMEntry *vm_entry, WasmFuncStats *stats,
+    WasmEdge_String wasm_func, const WasmEdge_Value *params, uint32_t param_num, WasmEdge_Value *returns,
+    uint32_t return_num)
+{
+    WasmEdge_Async *async = WasmEdge_VMAsyncExecute(vm_entry->vm, wasm_func, params, param_num);
+    if (async == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+
+    PG_TRY();
+    {
+        while (!WasmEdge_AsyncWaitFor(async, WASM_INTERRUPT_POLL_MS)) {
+            CHECK_FOR_INTERRUPTS();
+        }
+    }
+    PG_CATCH();
+    {
+        WasmEdge_AsyncCancel(async);
+        WasmEdge_AsyncWait(async);
+        WasmEdge_AsyncDelete(async);
+        stats->errors.fetch_add(1, std::memory_order_relaxed);
+        if (vm_entry->snapshot != NULL) {
+            wasm_forget_session_vm(vm_entry);
+        }
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    WasmEdge_Result ret = WasmEdge_AsyncGet(async, returns, return_num);
+    WasmEdge_AsyncDelete(async);
+    return ret;
+}
+
+static void wasm_vm_execute(WasmVMEntry *vm_entry, WasmFuncStats *stats, WasmEdge_String wasm_func,
+    const WasmEdge_Value *params, uint32_t param_num, WasmEdge_Value *returns, uint32_t return_num)
+{
+    // the statistics add up over the calls, so the budget is counted from the current total
+    uint64 cost_limit = UINT64_MAX;
+    if (wasm_fuel_limit > 0) {
+        cost_limit = WasmEdge_StatisticsGetTotalCost(vm_entry->stat) + (uint64)wasm_fuel_limit * 1000;
+    }
+    WasmEdge_StatisticsSetCostLimit(vm_entry->stat, cost_limit);
+
+    WasmHostState *host = vm_entry->host;
+    if (host != NULL) {
+        if (host->running) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("wasm_executor: instance %ld cannot be called by a query it runs", vm_entry->instanceid)));
+        }
+        host->running = true;
+    }
+
+    WasmEdge_Result ret;
+    uint64 start = wasm_stat_clock();
+    // host functions run queries, which only the session thread can
+    if (wasm_interruptible && host == NULL) {
+        ret = wasm_vm_execute_interruptible(vm_entry, stats, wasm_func, params, param_num, returns, return_num);
+    } else {
+        ret = WasmEdge_VMExecute(vm_entry->vm, wasm_func, params, param_num, returns, return_num);
+    }
+    ErrorData *host_error = (host != NULL) ? wasm_host_end_call(host) : NULL;
+    if (WasmEdge_ResultOK(ret)) {
+        wasm_stat_count_call(stats, start);
+        wasm_vm_account(vm_entry);
+        return;
+    }
+    stats->errors.fetch_add(1, std::memory_order_relaxed);
+    // a call of a snapshot instance which did not return may leave globals a restore cannot reach
+    if (vm_entry->snapshot != NULL) {
+        wasm_forget_session_vm(vm_entry);
+    }
+    if (host_error != NULL) {
+        ReThrowError(host_error);
+    }
+    if (WasmEdge_ResultGetCode(ret) == WasmEdge_ErrCode_CostLimitExceeded) {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("wasm_executor: call func %.*s ran out of fuel", (int)wasm_func.Length, wasm_func.Buf),
+            errdetail("A call may run %d thousand instructions.", wasm_fuel_limit),
+            errhint("Raise wasm_executor.fuel_limit if the function is expected to run longer.")));
+    }
+    ereport(ERROR, (errmsg("wasm_executor: call func %.*s failed: %s",
+        (int)wasm_func.Length, wasm_func.Buf, WasmEdge_ResultGetMessage(ret))));
+}
+
+static WasmEdge_MemoryInstanceContext* wasm_guest_memory(WasmVMEntry *vm_entry)
+{
+    if (vm_entry->memory == NULL) {
+        const WasmEdge_ModuleInstanceContext *module_cxt = WasmEdge_VMGetActiveModule(vm_entry->vm);
+        vm_entry->memory = WasmEdge_ModuleInstanceFindMemory(module_cxt,
+            WasmEdge_StringWrap(WASM_MEMORY_NAME, strlen(WASM_MEMORY_NAME)));
+        if (vm_entry->memory == NULL) {
+            ereport(ERROR, (errmsg("wasm_executor: instance %ld does not export its linear memory as \"%s\"",
+                vm_entry->instanceid, WASM_MEMORY_NAME)));
+        }
+    }
+    return vm_entry->memory;
+}
+
+/*
+ * Reserve size bytes in the linear memory through the alloc(i32) -> i32 export of
+ * the module.
+ */
+static uint32_t wasm_guest_alloc(WasmVMEntry *vm_entry, uint32_t size)
+{
+    WasmEdge_String alloc_func = WasmEdge_StringWrap(WASM_ALLOC_FUNC, strlen(WASM_ALLOC_FUNC));
+    if (WasmEdge_VMGetFunctionType(vm_entry->vm, alloc_func) == NULL) {
+        ereport(ERROR, (errmsg("wasm_executor: instance %ld has to export %s(i32) -> i32 to receive data",
+            vm_entry->instanceid, WASM_ALLOC_FUNC)));
+    }
+
+    if (vm_entry->alloc_stats == NULL) {
+        vm_entry->alloc_stats = wasm_func_stats(vm_entry->stats, WASM_ALLOC_FUNC);
+    }
+
+    WasmEdge_Value param = WasmEdge_ValueGenI32((int32_t)size);
+    WasmEdge_Value result;
+    wasm_vm_execute(vm_entry, vm_entry->alloc_stats, alloc_func, &param, 1, &result, 1);
+    uint32_t ptr = (uint32_t)WasmEdge_ValueGetI32(result);
+    if (ptr == 0) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+            errmsg("wasm_executor: instance %ld failed to allocate %u bytes", vm_entry->instanceid, size)));
+    }
+    return ptr;
+}
+
+// Give memory back through dealloc(i32, i32), modules without that export simply keep it
+static void wasm_guest_dealloc(WasmVMEntry *vm_entry, uint32_t ptr, uint32_t size)
+{
+    WasmEdge_String dealloc_func = WasmEdge_StringWrap(WASM_DEALLOC_FUNC, strlen(WASM_DEALLOC_FUNC));
+    if (WasmEdge_VMGetFunctionType(vm_entry->vm, dealloc_func) == NULL) {
+        return;
+    }
+    if (vm_entry->dealloc_stats == NULL) {
+        vm_entry->dealloc_stats = wasm_func_stats(vm_entry->stats, WASM_DEALLOC_FUNC);
+    }
+
+    WasmEdge_Value params[2];
+    params[0] = WasmEdge_ValueGenI32((int32_t)ptr);
+    params[1] = WasmEdge_ValueGenI32((int32_t)size);
+    wasm_vm_execute(vm_entry, vm_entry->dealloc_stats, dealloc_func, params, 2, NULL, 0);
+}
+
+static void wasm_guest_write(WasmVMEntry *vm_entry, uint32_t ptr, const void *data, uint32_t size)
+{
+    WasmEdge_Result ret = WasmEdge_MemoryInstanceSetData(wasm_guest_memory(vm_entry), (const uint8_t *)data, ptr, size);
+    if (!WasmEdge_ResultOK(ret)) {
+        ereport(ERROR, (errmsg("wasm_executor: failed to write %u bytes at %u into instance %ld: %s",
+            size, ptr, vm_entry->instanceid, WasmEdge_ResultGetMessage(ret))));
+    }
+}
+
+static void wasm_check_value_size(WasmVMEntry *vm_entry, uint64 size)
+{
+    if (size > (uint64)wasm_max_value_size * 1024L) {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+            errmsg("wasm_executor: value of %lu bytes for instance %ld exceeds wasm_executor.max_value_size",
+                size, vm_entry->instanceid)));
+    }
+}
+
+/*
+ * Copy a text or bytea argument into the linear memory, straight from the detoasted
+ * datum. Returns its address, the caller has to give it back with wasm_guest_dealloc.
+ */
+static uint32_t wasm_guest_copy_varlena(WasmVMEntry *vm_entry, Datum datum, uint32_t *size)
+{
+    struct varlena *value = PG_DETOAST_DATUM_PACKED(datum);
+    uint32_t len = VARSIZE_ANY_EXHDR(value);
+    wasm_check_value_size(vm_entry, len);
+
+    // an empty value still needs an address of its own
+    uint32_t ptr = wasm_guest_alloc(vm_entry, len > 0 ? len : 1);
+    wasm_guest_write(vm_entry, ptr, VARDATA_ANY(value), len);
+    if ((Pointer)value != DatumGetPointer(datum)) {
+        pfree(value);
+    }
+    *size = len;
+    return ptr;
+}
+
+// Build a text or bytea from the (ptr << 32 | len) a module returned
+static Datum wasm_guest_read_varlena(WasmVMEntry *vm_entry, int64 packed)
+{
+    uint32_t ptr = (uint32_t)((uint64)packed >> 32);
+    uint32_t len = (uint32_t)((uint64)packed & 0xFFFFFFFF);
+    wasm_check_value_size(vm_entry, len);
+
+    const uint8_t *data = WasmEdge_MemoryInstanceGetPointerConst(wasm_guest_memory(vm_entry), ptr, len);
+    if (data == NULL && len > 0) {
+        ereport(ERROR, (errmsg("wasm_executor: instance %ld returned %u bytes at %u, which is out of its memory",
+            vm_entry->instanceid, len, ptr)));
+    }
+    struct varlena *result = (struct varlena *)palloc(len + VARHDRSZ);
+    SET_VARSIZE(result, len + VARHDRSZ);
+    if (len > 0) {
+        errno_t rc = memcpy_s(VARDATA(result), len, data, len);
+        securec_check(rc, "\0", "\0");
+    }
+    return PointerGetDatum(result);
+}
+
+// The generic entry points only pass integers
+static void wasm_check_scalar_func(WasmFuncInfo *funcinfo)
+{
+    for (uint32_t i = 0; i < funcinfo->param_num; ++i) {
+        if (!WASM_VALUE_IS_INTEGER(funcinfo->params[i])) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: func %s takes %s and can only be called through its generated function",
+                    funcinfo->funcname.c_str(), funcinfo->inputs[i].c_str())));
+        }
+    }
+    if (funcinfo->result != WASM_VALUE_VOID && !WASM_VALUE_IS_INTEGER(funcinfo->result)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s returns %s and can only be called through its generated function",
+                funcinfo->funcname.c_str(), funcinfo->outputs.c_str())));
+    }
+}
+
+static void wasm_memo_release()
+{
+    if (session_memo == NULL) {
+        return;
+    }
+    free(session_memo->sets);
+    delete[] session_memo->entries;
+    delete[] session_memo->referenced;
+    delete[] session_memo->hands;
+    delete session_memo;
+    session_memo = NULL;
+}
+
+/*
+ * The result cache of the session, built for the current memo_cache_size and
+ * emptied when the registry changed since it was last used. NULL when it is off.
+ */
+static WasmMemoCache* wasm_memo_cache()
+{
+    wasm_attach_session();
+    if (session_memo != NULL && session_memo->size != wasm_memo_cache_size) {
+        wasm_memo_release();
+    }
+    if (wasm_memo_cache_size == 0) {
+        return NULL;
+    }
+
+    uint64 current_registry_generation = registry_generation.load(std::memory_order_relaxed);
+    if (session_memo == NULL) {
+        size_t set_size = sizeof(WasmMemoSet) + WASM_MEMO_WAYS * sizeof(WasmMemoEntry) + 2;
+        size_t set_num = 1;
+        while (set_num * 2 * set_size <= (size_t)wasm_memo_cache_size * 1024) {
+            set_num *= 2;
+        }
+        WasmMemoCache *memo = new(std::nothrow)WasmMemoCache();
+        void *sets = NULL;
+        if (memo == NULL || posix_memalign(&sets, WASM_CACHE_LINE_SIZE, set_num * sizeof(WasmMemoSet)) != 0) {
+            delete memo;
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+        session_memo = memo;
+        memo->size = wasm_memo_cache_size;
+        memo->set_mask = (uint32_t)(set_num - 1);
+        memo->sets = (WasmMemoSet *)sets;
+        memo->entries = new(std::nothrow)WasmMemoEntry[set_num * WASM_MEMO_WAYS];
+        memo->referenced = new(std::nothrow)uint8_t[set_num];
+        memo->hands = new(std::nothrow)uint8_t[set_num];
+        if (memo->entries == NULL || memo->referenced == NULL || memo->hands == NULL) {
+            wasm_memo_release();
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+        errno_t rc = memset_s(memo->hands, set_num, 0, set_num);
+        securec_check(rc, "\0", "\0");
+    }
+
+    WasmMemoCache *memo = session_memo;
+    if (memo->sets_valid && memo->registry_generation == current_registry_generation) {
+        return memo;
+    }
+    size_t set_num = (size_t)memo->set_mask + 1;
+    errno_t rc = memset_s(memo->sets, set_num * sizeof(WasmMemoSet), 0, set_num * sizeof(WasmMemoSet));
+    securec_check(rc, "\0", "\0");
+    rc = memset_s(memo->referenced, set_num, 0, set_num);
+    securec_check(rc, "\0", "\0");
+    memo->registry_generation = current_registry_generation;
+    memo->sets_valid = true;
+    return memo;
+}
+
+static uint64 wasm_memo_hash(const WasmFuncInfo *funcinfo, const int64 *args, uint32_t nargs)
+{
+    uint64 hash = (uint64)(uintptr_t)funcinfo;
+    for (uint32_t i = 0; i < nargs; ++i) {
+        hash = (hash ^ (uint64)args[i]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash | 1;
+}
+
+static bool wasm_memo_lookup(WasmMemoCache *memo, const WasmFuncInfo *funcinfo, const int64 *args, uint32_t nargs,
+    uint64 hash, uint64 *result)
+{
+    uint32_t set = (uint32_t)(hash >> 32) & memo->set_mask;
+    const uint64 *tags = memo->sets[set].tags;
+    for (uint32_t way = 0; way < WASM_MEMO_WAYS; ++way) {
+        if (tags[way] != hash) {
+            continue;
+        }
+        const WasmMemoEntry *entry = &memo->entries[set * WASM_MEMO_WAYS + way];
+        if (entry->funcinfo == funcinfo && entry->nargs == nargs &&
+            (nargs == 0 || memcmp(entry->args, args, nargs * sizeof(int64)) == 0)) {
+            memo->referenced[set] |= (uint8_t)(1 << way);
+            *result = entry->result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Keep a result in a free entry of its set, or in place of the first entry the
+ * CLOCK hand finds unused since it last passed. New entries start unreferenced,
+ * so that arguments seen once do not push out the ones seen over and over.
+ */
+static void wasm_memo_store(WasmMemoCache *memo, const WasmFuncInfo *funcinfo, const int64 *args, uint32_t nargs,
+    uint64 hash, uint64 result)
+{
+    uint32_t set = (uint32_t)(hash >> 32) & memo->set_mask;
+    uint64 *tags = memo->sets[set].tags;
+    uint32_t way = 0;
+    while (way < WASM_MEMO_WAYS && tags[way] != 0) {
+        way++;
+    }
+    if (way == WASM_MEMO_WAYS) {
+        way = memo->hands[set];
+        while ((memo->referenced[set] & (1 << way)) != 0) {
+            memo->referenced[set] &= (uint8_t)~(1 << way);
+            way = (way + 1) % WASM_MEMO_WAYS;
+        }
+        memo->hands[set] = (uint8_t)((way + 1) % WASM_MEMO_WAYS);
+    }
+
+    WasmMemoEntry *entry = &memo->entries[set * WASM_MEMO_WAYS + way];
+    entry->funcinfo = funcinfo;
+    entry->nargs = nargs;
+    for (uint32_t i = 0; i < nargs; ++i) {
+        entry->args[i] = args[i];
+    }
+    entry->result = result;
+    tags[way] = hash;
+    memo->referenced[set] &= (uint8_t)~(1 << way);
+}
+
+static int64 wasm_invoke_function(char *instanceid_str, char* funcname, const int64 *args, uint32_t nargs)
+{
+    int64 instanceid = atol(instanceid_str);
+    WasmInstanceInfo *info = find_instance(instanceid);
+    WasmFuncInfo *funcinfo = find_exported_func(info, funcname);
+    wasm_check_scalar_func(funcinfo);
+    if (nargs != funcinfo->param_num) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: func %s takes %u arguments but %u are given", funcname, funcinfo->param_num, nargs)));
+    }
+    WasmVMEntry *vm_entry = wasm_get_session_vm(info);
+
+    // the generated functions key the same entries by their Datums, which are these int64
+    WasmMemoCache *memo = NULL;
+    uint64 hash = 0;
+    uint64 memo_result = 0;
+    if (info->deterministic && funcinfo->result != WASM_VALUE_VOID && nargs <= WASM_MEMO_MAX_ARGS) {
+        memo = wasm_memo_cache();
+    }
+    WasmFuncStats *stats = wasm_func_stats(vm_entry->stats, funcinfo->funcname);
+    if (memo != NULL) {
+        hash = wasm_memo_hash(funcinfo, args, nargs);
+        if (wasm_memo_lookup(memo, funcinfo, args, nargs, hash, &memo_result)) {
+            stats->memo_hits.fetch_add(1, std::memory_order_relaxed);
+            return (int64)memo_result;
+        }
+        stats->memo_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    (void)wasm_vm_begin_call(vm_entry, true);
+
+    WasmCallBuffer<WasmEdge_Value> params(nargs);
+    for (uint32_t i = 0; i < nargs; ++i) {
+        if (funcinfo->params[i] == WASM_VALUE_I32) {
+            params[i] = WasmEdge_ValueGenI32(args[i]);
+        } else {
+            params[i] = WasmEdge_ValueGenI64(args[i]);
+        }
+    }
+
+    WasmEdge_Value result[1];
+    uint32_t return_num = (funcinfo->result == WASM_VALUE_VOID) ? 0 : 1;
+    wasm_vm_execute(vm_entry, stats, WasmEdge_StringWrap(funcname, strlen(funcname)), params.data(), nargs, result,
+        return_num);
+    int64 ret_val = 0;
+    if (return_num == 0) {
+        ret_val = 0;
+    } else if (funcinfo->result == WASM_VALUE_I32) {
+        ret_val = WasmEdge_ValueGetI32(result[0]);
+    } else {
+        ret_val = WasmEdge_ValueGetI64(result[0]);
+    }
+    if (memo != NULL) {
+        wasm_memo_store(memo, funcinfo, args, nargs, hash, (uint64)ret_val);
+    }
+
+    return ret_val;
+}
+
+static void wasm_clear_functions(WasmInstanceInfo *info)
+{
+    for (std::vector<WasmFuncInfo*>::iterator curr = info->functions.begin(); curr != info->functions.end(); curr++) {
+        delete *curr;
+    }
+    info->functions.clear();
+    info->function_index.clear();
+}
+
+// The SQL type of a wasm value type, NULL for v128 and the references
+static const char* wasm_valtype_name(enum WasmEdge_ValType type)
+{
+    switch (type) {
+        case WasmEdge_ValType_I32:
+            return "integer";
+        case WasmEdge_ValType_I64:
+            return "bigint";
+        case WasmEdge_ValType_F32:
+            return "real";
+        case WasmEdge_ValType_F64:
+            return "double precision";
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * The SQL signature of an export, false with a notice when it cannot have a SQL
+ * function: more arguments than a SQL function takes, more results than a record
+ * is built from, or v128 and references, which stay inside the module, e.g.
+ * between its SIMD kernels.
+ */
+static bool wasm_export_signature(const std::string &funcname, const WasmEdge_FunctionTypeContext *func_type,
+    WasmFuncInfo *funcinfo)
+{
+    uint32_t param_num = WasmEdge_FunctionTypeGetParametersLength(func_type);
+    uint32_t return_num = WasmEdge_FunctionTypeGetReturnsLength(func_type);
+    if (param_num > MAX_PARAMS || return_num > MAX_RETURNS) {
+        ereport(NOTICE, (errmsg("wasm_executor: func %s is not exported to SQL, it takes more than %d arguments "
+            "or returns more than %d values", funcname.c_str(), MAX_PARAMS, MAX_RETURNS)));
+        return false;
+    }
+    std::vector<enum WasmEdge_ValType> types(param_num + return_num);
+    param_num = WasmEdge_FunctionTypeGetParameters(func_type, types.data(), param_num);
+    return_num = WasmEdge_FunctionTypeGetReturns(func_type, types.data() + param_num, return_num);
+    for (uint32_t i = 0; i < param_num + return_num; ++i) {
+        const char *type_name = wasm_valtype_name(types[i]);
+        if (type_name == NULL) {
+            ereport(NOTICE, (errmsg("wasm_executor: func %s is not exported to SQL, "
+                "its signature has a value type other than i32, i64, f32 and f64", funcname.c_str())));
+            return false;
+        }
+        if (i < param_num) {
+            funcinfo->inputs.push_back(type_name);
+        } else {
+            // functions without result, such as dealloc, are left with an empty output
+            funcinfo->outputs += (i > param_num) ? "," : "";
+            funcinfo->outputs += type_name;
+        }
+    }
+    funcinfo->funcname = funcname;
+    return wasm_encode_signature(funcinfo);
+}
+
+/*
+ * Fill info->functions with the exported functions of the module and their
+ * signatures. They are read from the export and type sections of the module,
+ * parsed and validated with the features of the instance but not instantiated:
+ * its imports are only resolved and its start function only run by the first
+ * call of a session. Nothing is left behind on failure.
+ */
+static void wasm_introspect_exports(WasmInstanceInfo *info)
+{
+    WasmEdge_ConfigureContext *config_context = wasm_configure_create(info->features);
+    WasmEdge_ASTModuleContext *ast_cxt = NULL;
+    WasmEdge_LoaderContext *loader_cxt = WasmEdge_LoaderCreate(config_context);
+    WasmEdge_Result result = WasmEdge_LoaderParseFromBuffer(loader_cxt, &ast_cxt, info->bytes.data(),
+        info->bytes.size());
+    WasmEdge_LoaderDelete(loader_cxt);
+    if (!WasmEdge_ResultOK(result)) {
+        WasmEdge_ConfigureDelete(config_context);
+        ereport(ERROR, (errmsg("wasm_executor: failed to load %s: %s", info->wasm_file.c_str(),
+            WasmEdge_ResultGetMessage(result))));
+    }
+    WasmEdge_ValidatorContext *validator_cxt = WasmEdge_ValidatorCreate(config_context);
+    result = WasmEdge_ValidatorValidate(validator_cxt, ast_cxt);
+    WasmEdge_ValidatorDelete(validator_cxt);
+    WasmEdge_ConfigureDelete(config_context);
+    if (!WasmEdge_ResultOK(result)) {
+        WasmEdge_ASTModuleDelete(ast_cxt);
+        ereport(ERROR, (errmsg("wasm_executor: wasm file validation failed %s", WasmEdge_ResultGetMessage(result))));
+    }
+    // calls of such a module run in the session thread, where only fuel can stop them
+    if (wasm_fuel_limit == 0 && wasm_module_imports(ast_cxt, WASM_HOST_MODULE_NAME)) {
+        WasmEdge_ASTModuleDelete(ast_cxt);
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("wasm_executor: %s imports the host functions and cannot be registered without a fuel_limit",
+                info->wasm_file.c_str()),
+            errhint("Set wasm_executor.fuel_limit, its calls cannot be interrupted otherwise.")));
+    }
+
+    uint32_t export_num = WasmEdge_ASTModuleListExportsLength(ast_cxt);
+    std::vector<const WasmEdge_ExportTypeContext *> exports(export_num);
+    export_num = WasmEdge_ASTModuleListExports(ast_cxt, exports.data(), export_num);
+    for (uint32_t i = 0; i < export_num; ++i) {
+        if (WasmEdge_ExportTypeGetExternalType(exports[i]) != WasmEdge_ExternalType_Function) {
+            continue;
+        }
+        WasmEdge_String name = WasmEdge_ExportTypeGetExternalName(exports[i]);
+        std::string funcname(name.Buf, name.Length);
+        elog(DEBUG1, "wasm_executor: exported function %s", funcname.c_str());
+
+        WasmFuncInfo *funcinfo = new(std::nothrow)WasmFuncInfo();
+        if (funcinfo == NULL) {
+            WasmEdge_ASTModuleDelete(ast_cxt);
+            wasm_clear_functions(info);
+            ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+        }
+        if (!wasm_export_signature(funcname, WasmEdge_ExportTypeGetFunctionType(ast_cxt, exports[i]), funcinfo)) {
+            delete funcinfo;
+            continue;
+        }
+        wasm_add_function(info, funcinfo);
+    }
+
+    WasmEdge_ASTModuleDelete(ast_cxt);
+    elog(DEBUG1, "wasm_executor:init exported func info for instanceid %ld", info->instanceid);
+}
+
+static void wasm_export_funcs_query(int64 instanceid, TupleFuncState* inter_call_data)
+{
+    WasmInstanceInfo *info = find_instance(instanceid);
+    inter_call_data->currindex = info->functions.begin();
+    inter_call_data->lastindex = info->functions.end();
+}
+
+// The isolation, volatility and features arguments of wasm_create_new_instance and its variants
+static void wasm_registration_options(FunctionCallInfo fcinfo, WasmIsolation *isolation, bool *deterministic,
+    uint32 *features)
+{
+    *isolation = WASM_ISOLATION_SHARED;
+    if (PG_NARGS() > 1) {
+        *isolation = wasm_isolation_of(TextDatumGetCString(PG_GETARG_DATUM(1)));
+    }
+    // only the results of immutable exports may be cached
+    *deterministic = false;
+    if (PG_NARGS() > 2) {
+        *deterministic = (strcmp(TextDatumGetCString(PG_GETARG_DATUM(2)), "immutable") == 0);
+    }
+    *features = WASM_FEATURES_ALL;
+    if (PG_NARGS() > 3) {
+        *features = wasm_features_of(TextDatumGetCString(PG_GETARG_DATUM(3)));
+    }
+}
+
+/*
+ * Register the module of wasm_file, whose bytes are read from that file unless
+ * given. An instance registered before only gets its options changed.
+ */
+static Datum wasm_register_instance(int64 uuid, const char *wasm_file, const std::vector<uint8_t> *module_bytes,
+    WasmIsolation isolation, bool deterministic, uint32 features)
+{
+    if (!superuser())
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to create wasm instance"))));
+
+    WasmInstanceInfo *info = registry_lookup(uuid);
+    if (info == NULL) {
+        info = wasm_rehydrate_instance(uuid);
+    }
+    if (info != NULL &&
+        (info->isolation != isolation || info->deterministic != deterministic || info->features != features)) {
+        // a new generation, so that the sessions build their VMs with the new options and drop cached results
+        WasmInstanceInfo *isolated = wasm_copy_instance_info(info);
+        isolated->isolation = isolation;
+        isolated->deterministic = deterministic;
+        isolated->features = features;
+        if (info->features != features) {
+            // the module has to be valid with the new proposals
+            wasm_clear_functions(isolated);
+            PG_TRY();
+            {
+                wasm_introspect_exports(isolated);
+            }
+            PG_CATCH();
+            {
+                wasm_free_instance_info(isolated);
+                PG_RE_THROW();
+            }
+            PG_END_TRY();
+        }
+        wasm_check_snapshot_globals(isolated);
+        isolated->generation = next_instance_generation++;
+        registry_replace(isolated);
+        return Int64GetDatum(uuid);
+    }
+    if (info != NULL) {
+        ereport(NOTICE, (errmsg("wasm_executor: instance already created for %s", wasm_file)));
+        return Int64GetDatum(uuid);
+    }
+
+    info = new(std::nothrow)WasmInstanceInfo();
+    if (info == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("wasm_executor: out of memory")));
+    }
+    info->instanceid = uuid;
+    info->isolation = isolation;
+    info->deterministic = deterministic;
+    info->features = features;
+    info->wasm_file = wasm_file;
+    WasmInstanceStats *stats = wasm_instance_stats(uuid);
+    uint64 start = wasm_stat_clock();
+    if (module_bytes != NULL) {
+        info->bytes = *module_bytes;
+    } else {
+        wasm_read_module_file(wasm_file, info->bytes);
+        info->preloaded = wasm_find_preloaded(wasm_file, &info->bytes);
+    }
+    wasm_introspect_exports(info);
+    wasm_check_snapshot_globals(info);
+    stats->loads.fetch_add(1, std::memory_order_relaxed);
+    wasm_stat_add_time(stats->load_time, start);
+
+    // Compile ahead of time now, so that the first call of every session finds the artifact
+    if (wasm_execution_mode != WASM_EXEC_INTERPRETER) {
+        std::string artifact = wasm_aot_artifact_path(info->bytes, info->features);
+        if (access(artifact.c_str(), R_OK) != 0 &&
+            !wasm_aot_compile(wasm_file, info->bytes, info->features, artifact,
+                wasm_execution_mode == WASM_EXEC_AOT ? ERROR : DEBUG1, stats)) {
+            elog(DEBUG1, "wasm_executor: %s will be run by the interpreter", wasm_file);
+        }
+    }
+
+    info->generation = next_instance_generation++;
+    (void)registry_publish(info);
+    return Int64GetDatum(uuid);
+}
+
+PG_FUNCTION_INFO_V1(wasm_create_instance);
+Datum wasm_create_instance(PG_FUNCTION_ARGS) 
+{
+    int64 uuid = generate_uuid(PG_GETARG_DATUM(0));
+    text *arg = PG_GETARG_TEXT_P(0);
+    char* filepath = text_to_cstring(arg);
+    canonicalize_path(filepath);
+    WasmIsolation isolation;
+    bool deterministic;
+    uint32 features;
+    wasm_registration_options(fcinfo, &isolation, &deterministic, &features);
+    return wasm_register_instance(uuid, filepath, NULL, isolation, deterministic, features);
+}
+
+/*
+ * Register a module kept in wasm.modules. The instance is named after the hash of
+ * its bytes, so registering the same bytes again finds the same instance.
+ */
+PG_FUNCTION_INFO_V1(wasm_create_instance_from_bytes);
+Datum wasm_create_instance_from_bytes(PG_FUNCTION_ARGS)
+{
+    bytea *module = PG_GETARG_BYTEA_PP(0);
+    std::vector<uint8_t> bytes((uint8_t *)VARDATA_ANY(module), (uint8_t *)VARDATA_ANY(module) + VARSIZE_ANY_EXHDR(module));
+    std::string wasm_file = WASM_MODULE_HASH_PREFIX + wasm_sha256_hex(bytes.data(), bytes.size(), "");
+    int64 uuid = generate_uuid(CStringGetTextDatum(wasm_file.c_str()));
+    WasmIsolation isolation;
+    bool deterministic;
+    uint32 features;
+    wasm_registration_options(fcinfo, &isolation, &deterministic, &features);
+    return wasm_register_instance(uuid, wasm_file.c_str(), &bytes, isolation, deterministic, features);
+}
+
+// The key of a module in wasm.modules
+PG_FUNCTION_INFO_V1(wasm_module_hash);
+Datum wasm_module_hash(PG_FUNCTION_ARGS)
+{
+    bytea *module = PG_GETARG_BYTEA_PP(0);
+    std::string hash = wasm_sha256_hex(VARDATA_ANY(module), VARSIZE_ANY_EXHDR(module), "");
+    PG_RETURN_TEXT_P(cstring_to_text(hash.c_str()));
+}
+
+PG_FUNCTION_INFO_V1(wasm_get_instances);
+Datum wasm_get_instances(PG_FUNCTION_ARGS) 
+{
+    FuncCallContext* fctx = NULL;
+    TupleInstanceState* inter_call_data = NULL;
+    if (SRF_IS_FIRSTCALL()) {
+        TupleDesc tupdesc;
+        MemoryContext mctx;
+
+        fctx = SRF_FIRSTCALL_INIT();
+        mctx = MemoryContextSwitchTo(fctx->multi_call_memory_ctx);
+        inter_call_data = (TupleInstanceState*)palloc(sizeof(TupleInstanceState));
+
+        /* Build a tuple descriptor for our result type */
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            elog(ERROR, "wasm_executor: return type must be a row type");
+
+        // take a snapshot, the registry may change while we return rows
+        std::vector<std::pair<int64, std::string> > snapshot;
+        instances.for_each([&](int64 instanceid, WasmInstanceInfo *info) {
+            snapshot.push_back(std::pair<int64, std::string>(instanceid, info->wasm_file));
+        });
+
+        inter_call_data->tupd = tupdesc;
+        inter_call_data->count = snapshot.size();
+        inter_call_data->currindex = 0;
+        inter_call_data->instanceids = (int64*)palloc(sizeof(int64) * (snapshot.size() + 1));
+        inter_call_data->wasm_files = (char**)palloc(sizeof(char*) * (snapshot.size() + 1));
+        for (unsigned int i = 0; i < snapshot.size(); ++i) {
+            inter_call_data->instanceids[i] = snapshot[i].first;
+            inter_call_data->wasm_files[i] = pstrdup(snapshot[i].second.c_str());
+        }
+
+        fctx->user_fctx = inter_call_data;
+        MemoryContextSwitchTo(mctx);
+    }
+
+    fctx = SRF_PERCALL_SETUP();
+    inter_call_data = (TupleInstanceState*)(fctx->user_fctx);
+    
+    if (inter_call_data->currindex < inter_call_data->count) {
+        HeapTuple resultTuple;
+        Datum result;
+        Datum values[2];
+        bool nulls[2];
+
+        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
+        securec_check_c(rc, "\0", "\0");
+
+        values[0] = Int64GetDatum(inter_call_data->instanceids[inter_call_data->currindex]);
+        values[1] = CStringGetTextDatum(inter_call_data->wasm_files[inter_call_data->currindex]);
+
+        /* Build and return the result tuple. */
+        resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
+        result = HeapTupleGetDatum(resultTuple);
+
+        inter_call_data->currindex++;
+        SRF_RETURN_NEXT(fctx, result);
+    } else {
+        SRF_RETURN_DONE(fctx);
+    }
+}
+
+PG_FUNCTION_INFO_V1(wasm_get_exported_functions);
+Datum wasm_get_exported_functions(PG_FUNCTION_ARGS) 
+{
+    int64 instanceid = PG_GETARG_INT64(0);
+    FuncCallContext* fctx = NULL;
+    TupleFuncState* inter_call_data = NULL;
+    if (SRF_IS_FIRSTCALL()) {
+        TupleDesc tupdesc;
+        MemoryContext mctx;
+
+        fctx = SRF_FIRSTCALL_INIT();
+        mctx = MemoryContextSwitchTo(fctx->multi_call_memory_ctx);
+        inter_call_data = (TupleFuncState*)palloc(sizeof(TupleFuncState));
+        
+        /* Build a tuple descriptor for our result type */
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            elog(ERROR, "wasm_executor: return type must be a row type");
+
+        inter_call_data->tupd = tupdesc;
+        wasm_export_funcs_query(instanceid, inter_call_data);
+
+        fctx->user_fctx = inter_call_data;
+        MemoryContextSwitchTo(mctx);
+    }
+    fctx = SRF_PERCALL_SETUP();
+    inter_call_data = (TupleFuncState*)(fctx->user_fctx);
+    
+    if (inter_call_data->currindex != inter_call_data->lastindex) {
+        HeapTuple resultTuple;
+        Datum result;
+        Datum values[3];
+        bool nulls[3];
+
+        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
+        securec_check_c(rc, "\0", "\0");
+
+        WasmFuncInfo *funcinfo = *inter_call_data->currindex;
+        values[0] = CStringGetTextDatum(funcinfo->funcname.c_str());
+        std::string inputs;
+        for (std::vector<std::string>::iterator curr = funcinfo->inputs.begin(); curr != funcinfo->inputs.end(); curr++) {
+            inputs += *curr;
+            inputs += ",";
+        }
+        if (inputs.length() > 0) {
+            inputs.pop_back();
+        }
+        values[1] = CStringGetTextDatum(inputs.c_str());
+        values[2] = CStringGetTextDatum(funcinfo->outputs.c_str());
+
+        /* Build and return the result tuple. */
+        resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
+        result = HeapTupleGetDatum(resultTuple);
+        inter_call_data->currindex++;
+
+        SRF_RETURN_NEXT(fctx, result);
+    } else {
+        SRF_RETURN_DONE(fctx);
+    }
+}
+
+PG_FUNCTION_INFO_V1(wasm_discard_cache);
+Datum wasm_discard_cache(PG_FUNCTION_ARGS)
+{
+    wasm_release_session_vms(0, 0);
+    PG_RETURN_VOID();
+}
+
+/*
+ * Copy the counters of every export, or of every instance, into rows allocated in
+ * the current memory context. Nothing is allocated there under the locks.
+ */
+static int wasm_stat_snapshot(bool functions, WasmStatRow **rows)
+{
+    std::vector<WasmStatRow> snapshot;
+    std::vector<std::string> funcnames;
+    instance_stats.for_each([&](int64 instanceid, WasmInstanceStats *stats) {
+        WasmStatRow row;
+        errno_t rc = memset_s(&row, sizeof(row), 0, sizeof(row));
+        securec_check_c(rc, "\0", "\0");
+        row.instanceid = instanceid;
+        if (!functions) {
+            row.counters[0] = stats->loads.load(std::memory_order_relaxed);
+            row.counters[1] = stats->load_time.load(std::memory_order_relaxed);
+            row.counters[2] = stats->compiles.load(std::memory_order_relaxed);
+            row.counters[3] = stats->compile_time.load(std::memory_order_relaxed);
+            row.counters[4] = stats->instantiations.load(std::memory_order_relaxed);
+            row.counters[5] = stats->instantiate_time.load(std::memory_order_relaxed);
+            row.counters[6] = stats->vm_hits.load(std::memory_order_relaxed);
+            row.counters[7] = stats->vm_misses.load(std::memory_order_relaxed);
+            row.counters[8] = stats->restores.load(std::memory_order_relaxed);
+            row.counters[9] = stats->restore_time.load(std::memory_order_relaxed);
+            row.counters[10] = stats->evictions.load(std::memory_order_relaxed);
+            row.counters[11] = stats->vms.load(std::memory_order_relaxed);
+            row.counters[12] = stats->memory.load(std::memory_order_relaxed);
+            snapshot.push_back(row);
+            return;
+        }
+        pthread_mutex_lock(&stats->lock);
+        for (std::map<std::string, WasmFuncStats*>::iterator itor = stats->functions.begin();
+             itor != stats->functions.end(); itor++) {
+            WasmFuncStats *func_stats = itor->second;
+            row.counters[0] = func_stats->calls.load(std::memory_order_relaxed);
+            row.counters[1] = func_stats->errors.load(std::memory_order_relaxed);
+            row.counters[2] = func_stats->exec_time.load(std::memory_order_relaxed);
+            row.counters[3] = func_stats->max_exec_time.load(std::memory_order_relaxed);
+            row.counters[4] = func_stats->marshal_time.load(std::memory_order_relaxed);
+            row.counters[5] = func_stats->memo_hits.load(std::memory_order_relaxed);
+            row.counters[6] = func_stats->memo_misses.load(std::memory_order_relaxed);
+            for (int i = 0; i < WASM_STAT_BUCKETS; ++i) {
+                row.histogram[i] = func_stats->histogram[i].load(std::memory_order_relaxed);
+            }
+            snapshot.push_back(row);
+            funcnames.push_back(itor->first);
+        }
+        pthread_mutex_unlock(&stats->lock);
+    });
+
+    *rows = (WasmStatRow *)palloc(sizeof(WasmStatRow) * (snapshot.size() + 1));
+    for (unsigned int i = 0; i < snapshot.size(); ++i) {
+        (*rows)[i] = snapshot[i];
+        (*rows)[i].funcname = functions ? pstrdup(funcnames[i].c_str()) : NULL;
+    }
+    return snapshot.size();
+}
+
+static void wasm_stat_first_call(FunctionCallInfo fcinfo, bool functions)
+{
+    FuncCallContext *fctx = SRF_FIRSTCALL_INIT();
+    MemoryContext mctx = MemoryContextSwitchTo(fctx->multi_call_memory_ctx);
+    TupleStatState *inter_call_data = (TupleStatState*)palloc(sizeof(TupleStatState));
+
+    /* Build a tuple descriptor for our result type */
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "wasm_executor: return type must be a row type");
+
+    inter_call_data->tupd = tupdesc;
+    inter_call_data->count = wasm_stat_snapshot(functions, &inter_call_data->rows);
+    inter_call_data->currindex = 0;
+
+    fctx->user_fctx = inter_call_data;
+    MemoryContextSwitchTo(mctx);
+}
+
+// Nanoseconds as milliseconds, like the times of pg_stat_user_functions
+static Datum wasm_stat_time_datum(uint64 ns)
+{
+    return Float8GetDatum((double)ns / 1000000.0);
+}
+
+PG_FUNCTION_INFO_V1(wasm_stat_functions);
+Datum wasm_stat_functions(PG_FUNCTION_ARGS)
+{
+    if (SRF_IS_FIRSTCALL()) {
+        wasm_stat_first_call(fcinfo, true);
+    }
+    FuncCallContext* fctx = SRF_PERCALL_SETUP();
+    TupleStatState* inter_call_data = (TupleStatState*)(fctx->user_fctx);
+
+    if (inter_call_data->currindex < inter_call_data->count) {
+        WasmStatRow *row = &inter_call_data->rows[inter_call_data->currindex];
+        Datum values[10];
+        bool nulls[10];
+        Datum histogram[WASM_STAT_BUCKETS];
+
+        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
+        securec_check_c(rc, "\0", "\0");
+
+        values[0] = Int64GetDatum(row->instanceid);
+        values[1] = CStringGetTextDatum(row->funcname);
+        values[2] = Int64GetDatum((int64)row->counters[0]);
+        values[3] = Int64GetDatum((int64)row->counters[1]);
+        values[4] = wasm_stat_time_datum(row->counters[2]);
+        values[5] = wasm_stat_time_datum(row->counters[3]);
+        values[6] = wasm_stat_time_datum(row->counters[4]);
+        values[7] = Int64GetDatum((int64)row->counters[5]);
+        values[8] = Int64GetDatum((int64)row->counters[6]);
+        for (int i = 0; i < WASM_STAT_BUCKETS; ++i) {
+            histogram[i] = Int64GetDatum((int64)row->histogram[i]);
+        }
+        values[9] = PointerGetDatum(construct_array(histogram, WASM_STAT_BUCKETS, INT8OID, sizeof(int64), true, 'd'));
+
+        /* Build and return the result tuple. */
+        HeapTuple resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
+        inter_call_data->currindex++;
+        SRF_RETURN_NEXT(fctx, HeapTupleGetDatum(resultTuple));
+    } else {
+        SRF_RETURN_DONE(fctx);
+    }
+}
+
+PG_FUNCTION_INFO_V1(wasm_stat_instances);
+Datum wasm_stat_instances(PG_FUNCTION_ARGS)
+{
+    if (SRF_IS_FIRSTCALL()) {
+        wasm_stat_first_call(fcinfo, false);
+    }
+    FuncCallContext* fctx = SRF_PERCALL_SETUP();
+    TupleStatState* inter_call_data = (TupleStatState*)(fctx->user_fctx);
+
+    if (inter_call_data->currindex < inter_call_data->count) {
+        WasmStatRow *row = &inter_call_data->rows[inter_call_data->currindex];
+        Datum values[14];
+        bool nulls[14];
+
+        errno_t rc = memset_s(nulls, sizeof(nulls), 0, sizeof(nulls));
+        securec_check_c(rc, "\0", "\0");
+
+        values[0] = Int64GetDatum(row->instanceid);
+        values[1] = Int64GetDatum((int64)row->counters[0]);
+        values[2] = wasm_stat_time_datum(row->counters[1]);
+        values[3] = Int64GetDatum((int64)row->counters[2]);
+        values[4] = wasm_stat_time_datum(row->counters[3]);
+        values[5] = Int64GetDatum((int64)row->counters[4]);
+        values[6] = wasm_stat_time_datum(row->counters[5]);
+        values[7] = Int64GetDatum((int64)row->counters[6]);
+        values[8] = Int64GetDatum((int64)row->counters[7]);
+        values[9] = Int64GetDatum((int64)row->counters[8]);
+        values[10] = wasm_stat_time_datum(row->counters[9]);
+        values[11] = Int64GetDatum((int64)row->counters[10]);
+        values[12] = Int64GetDatum((int64)row->counters[11]);
+        values[13] = Int64GetDatum((int64)row->counters[12]);
+
+        /* Build and return the result tuple. */
+        HeapTuple resultTuple = heap_form_tuple(inter_call_data->tupd, values, nulls);
+        inter_call_data->currindex++;
+        SRF_RETURN_NEXT(fctx, HeapTupleGetDatum(resultTuple));
+    } else {
+        SRF_RETURN_DONE(fctx);
+    }
+}
+
+PG_FUNCTION_INFO_V1(wasm_stat_reset);
+Datum wasm_stat_reset(PG_FUNCTION_ARGS)
+{
+    if (!superuser())
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to reset wasm statistics"))));
+
+    instance_stats.for_each([](int64 instanceid, WasmInstanceStats *stats) {
+        stats->loads.store(0, std::memory_order_relaxed);
+        stats->load_time.store(0, std::memory_order_relaxed);
+        stats->compiles.store(0, std::memory_order_relaxed);
+        stats->compile_time.store(0, std::memory_order_relaxed);
+        stats->instantiations.store(0, std::memory_order_relaxed);
+        stats->instantiate_time.store(0, std::memory_order_relaxed);
+        stats->vm_hits.store(0, std::memory_order_relaxed);
+        stats->vm_misses.store(0, std::memory_order_relaxed);
+        stats->restores.store(0, std::memory_order_relaxed);
+        stats->restore_time.store(0, std::memory_order_relaxed);
+        stats->evictions.store(0, std::memory_order_relaxed);
+        pthread_mutex_lock(&stats->lock);
+        for (std::map<std::string, WasmFuncStats*>::iterator itor = stats->functions.begin();
+             itor != stats->functions.end(); itor++) {
+            WasmFuncStats *func_stats = itor->second;
+            func_stats->calls.store(0, std::memory_order_relaxed);
+            func_stats->errors.store(0, std::memory_order_relaxed);
+            func_stats->exec_time.store(0, std::memory_order_relaxed);
+            func_stats->max_exec_time.store(0, std::memory_order_relaxed);
+            func_stats->marshal_time.store(0, std::memory_order_relaxed);
+            func_stats->memo_hits.store(0, std::memory_order_relaxed);
+            func_stats->memo_misses.store(0, std::memory_order_relaxed);
+            for (int i = 0; i < WASM_STAT_BUCKETS; ++i) {
+                func_stats->histogram[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        pthread_mutex_unlock(&stats->lock);
+    });
+    PG_RETURN_VOID();
+}
+
+/*
+ * Conversions between Datums and wasm values, one specialization per scalar kind,
+ * so that an invoker converts straight into its stack array.
+ */
+template <WasmValueKind kind>
+struct WasmValueTraits;
+
+template <>
+struct WasmValueTraits<WASM_VALUE_I32> {
+    static WasmEdge_Value to_wasm(Datum value)
+    {
+        return WasmEdge_ValueGenI32(DatumGetInt32(value));
+    }
+    static Datum to_datum(WasmEdge_Value value)
+    {
+        return Int32GetDatum(WasmEdge_ValueGetI32(value));
+    }
+};
+
+template <>
+struct WasmValueTraits<WASM_VALUE_I64> {
+    static WasmEdge_Value to_wasm(Datum value)
+    {
+        return WasmEdge_ValueGenI64(DatumGetInt64(value));
+    }
+    static Datum to_datum(WasmEdge_Value value)
+    {
+        return Int64GetDatum(WasmEdge_ValueGetI64(value));
+    }
+};
+
+template <>
+struct WasmValueTraits<WASM_VALUE_F32> {
+    static WasmEdge_Value to_wasm(Datum value)
+    {
+        return WasmEdge_ValueGenF32(DatumGetFloat4(value));
+    }
+    static Datum to_datum(WasmEdge_Value value)
+    {
+        return Float4GetDatum(WasmEdge_ValueGetF32(value));
+    }
+};
+
+template <>
+struct WasmValueTraits<WASM_VALUE_F64> {
+    static WasmEdge_Value to_wasm(Datum value)
+    {
+        return WasmEdge_ValueGenF64(DatumGetFloat8(value));
+    }
+    static Datum to_datum(WasmEdge_Value value)
+    {
+        return Float8GetDatum(WasmEdge_ValueGetF64(value));
+    }
+};
+
+static WasmArgConverter wasm_arg_converter(WasmValueKind kind)
+{
+    switch (kind) {
+        case WASM_VALUE_I32:
+            return WasmValueTraits<WASM_VALUE_I32>::to_wasm;
+        case WASM_VALUE_I64:
+            return WasmValueTraits<WASM_VALUE_I64>::to_wasm;
+        case WASM_VALUE_F32:
+            return WasmValueTraits<WASM_VALUE_F32>::to_wasm;
+        case WASM_VALUE_F64:
+            return WasmValueTraits<WASM_VALUE_F64>::to_wasm;
+        default:
+            return NULL;
+    }
+}
+
+// Invoker of exports taking nargs scalars and returning a scalar of kind result
+template <uint32_t nargs, WasmValueKind result>
+static Datum wasm_invoke_scalar(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmEdge_Value params[nargs > 0 ? nargs : 1];
+    for (uint32_t i = 0; i < nargs; ++i) {
+        params[i] = plan->converters[i](PG_GETARG_DATUM(i));
+    }
+    WasmEdge_Value returns[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->wasm_func, params, nargs, returns, 1);
+    return WasmValueTraits<result>::to_datum(returns[0]);
+}
+
+template <uint32_t nargs>
+static Datum wasm_invoke_scalar_void(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmEdge_Value params[nargs > 0 ? nargs : 1];
+    for (uint32_t i = 0; i < nargs; ++i) {
+        params[i] = plan->converters[i](PG_GETARG_DATUM(i));
+    }
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->wasm_func, params, nargs, NULL, 0);
+    PG_RETURN_VOID();
+}
+
+#define WASM_SCALAR_INVOKERS(nargs) \
+    { wasm_invoke_scalar<nargs, WASM_VALUE_I32>, wasm_invoke_scalar<nargs, WASM_VALUE_I64>, \
+      wasm_invoke_scalar<nargs, WASM_VALUE_F32>, wasm_invoke_scalar<nargs, WASM_VALUE_F64>, \
+      wasm_invoke_scalar_void<nargs> }
+
+// By number of arguments, then I32, I64, F32, F64 and VOID result
+static const WasmInvoker wasm_scalar_invokers[WASM_SPECIALIZED_PARAMS + 1][5] = {
+    WASM_SCALAR_INVOKERS(0), WASM_SCALAR_INVOKERS(1), WASM_SCALAR_INVOKERS(2), WASM_SCALAR_INVOKERS(3),
+    WASM_SCALAR_INVOKERS(4), WASM_SCALAR_INVOKERS(5), WASM_SCALAR_INVOKERS(6), WASM_SCALAR_INVOKERS(7),
+    WASM_SCALAR_INVOKERS(8), WASM_SCALAR_INVOKERS(9), WASM_SCALAR_INVOKERS(10)
+};
+
+// Invoker of exports taking or returning text or bytea
+static Datum wasm_invoke_varlena(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmCallBuffer<WasmEdge_Value> params(plan->wasm_param_num);
+    WasmCallBuffer<uint32_t> guest_ptrs(plan->param_num);
+    WasmCallBuffer<uint32_t> guest_sizes(plan->param_num);
+    uint32_t guest_num = 0;
+    uint32_t wasm_param_num = 0;
+    uint64 start = wasm_stat_clock();
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        if (WASM_VALUE_IS_VARLENA(plan->params[i])) {
+            guest_ptrs[guest_num] = wasm_guest_copy_varlena(plan->vm_entry, PG_GETARG_DATUM(i), &guest_sizes[guest_num]);
+            params[wasm_param_num++] = WasmEdge_ValueGenI32((int32_t)guest_ptrs[guest_num]);
+            params[wasm_param_num++] = WasmEdge_ValueGenI32((int32_t)guest_sizes[guest_num]);
+            guest_num++;
+        } else {
+            params[wasm_param_num++] = plan->converters[i](PG_GETARG_DATUM(i));
+        }
+    }
+
+    wasm_stat_add_time(plan->stats->marshal_time, start);
+
+    WasmEdge_Value result[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->wasm_func, params.data(), wasm_param_num, result,
+        plan->return_num);
+
+    start = wasm_stat_clock();
+    Datum ret = (Datum)0;
+    switch (plan->result) {
+        case WASM_VALUE_VOID:
+            break;
+        case WASM_VALUE_I32:
+            ret = WasmValueTraits<WASM_VALUE_I32>::to_datum(result[0]);
+            break;
+        case WASM_VALUE_I64:
+            ret = WasmValueTraits<WASM_VALUE_I64>::to_datum(result[0]);
+            break;
+        case WASM_VALUE_F32:
+            ret = WasmValueTraits<WASM_VALUE_F32>::to_datum(result[0]);
+            break;
+        case WASM_VALUE_F64:
+            ret = WasmValueTraits<WASM_VALUE_F64>::to_datum(result[0]);
+            break;
+        default: {
+            int64 packed = WasmEdge_ValueGetI64(result[0]);
+            ret = wasm_guest_read_varlena(plan->vm_entry, packed);
+            uint32_t len = (uint32_t)((uint64)packed & 0xFFFFFFFF);
+            wasm_guest_dealloc(plan->vm_entry, (uint32_t)((uint64)packed >> 32), len > 0 ? len : 1);
+            break;
+        }
+    }
+    // the result is read first, so that releasing the arguments cannot touch it
+    for (uint32_t i = 0; i < guest_num; ++i) {
+        wasm_guest_dealloc(plan->vm_entry, guest_ptrs[i], guest_sizes[i] > 0 ? guest_sizes[i] : 1);
+    }
+    wasm_stat_add_time(plan->stats->marshal_time, start);
+    if (plan->result == WASM_VALUE_VOID) {
+        PG_RETURN_VOID();
+    }
+    PG_RETURN_DATUM(ret);
+}
+
+static Datum wasm_value_datum(WasmValueKind kind, WasmEdge_Value value)
+{
+    switch (kind) {
+        case WASM_VALUE_I32:
+            return WasmValueTraits<WASM_VALUE_I32>::to_datum(value);
+        case WASM_VALUE_I64:
+            return WasmValueTraits<WASM_VALUE_I64>::to_datum(value);
+        case WASM_VALUE_F32:
+            return WasmValueTraits<WASM_VALUE_F32>::to_datum(value);
+        default:
+            return WasmValueTraits<WASM_VALUE_F64>::to_datum(value);
+    }
+}
+
+// Invoker of exports taking more scalars than the specialized ones
+static Datum wasm_invoke_scalar_any(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmCallBuffer<WasmEdge_Value> params(plan->param_num);
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        params[i] = plan->converters[i](PG_GETARG_DATUM(i));
+    }
+    WasmEdge_Value returns[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->wasm_func, params.data(), plan->param_num, returns,
+        plan->return_num);
+    if (plan->result == WASM_VALUE_VOID) {
+        PG_RETURN_VOID();
+    }
+    return wasm_value_datum(plan->result, returns[0]);
+}
+
+/*
+ * Invoker of multi-value exports, whose results are the columns of a record. The
+ * tuple descriptor of the SQL function is checked and kept with the plan on the
+ * first call.
+ */
+static Datum wasm_invoke_record(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmCallBuffer<WasmEdge_Value> params(plan->param_num);
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        params[i] = plan->converters[i](PG_GETARG_DATUM(i));
+    }
+    WasmEdge_Value returns[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->wasm_func, params.data(), plan->param_num, returns,
+        plan->return_num);
+
+    if (plan->tupdesc == NULL) {
+        MemoryContext oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: function %u has to return a record of %s", fcinfo->flinfo->fn_oid,
+                    plan->funcinfo->outputs.c_str())));
+        }
+        bool matches = (tupdesc->natts == (int)plan->return_num);
+        for (uint32_t i = 0; matches && i < plan->return_num; ++i) {
+            matches = (SPI_gettypeid(tupdesc, i + 1) == wasm_kind_type(plan->funcinfo->results[i]));
+        }
+        if (!matches) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: result of function %u does not match func %s", fcinfo->flinfo->fn_oid,
+                    plan->funcinfo->funcname.c_str())));
+        }
+        plan->tupdesc = BlessTupleDesc(tupdesc);
+        (void)MemoryContextSwitchTo(oldcontext);
+    }
+
+    uint64 start = wasm_stat_clock();
+    Datum values[MAX_RETURNS];
+    bool nulls[MAX_RETURNS];
+    for (uint32_t i = 0; i < plan->return_num; ++i) {
+        values[i] = wasm_value_datum(plan->funcinfo->results[i], returns[i]);
+        nulls[i] = false;
+    }
+    HeapTuple tuple = heap_form_tuple(plan->tupdesc, values, nulls);
+    wasm_stat_add_time(plan->stats->marshal_time, start);
+    return HeapTupleGetDatum(tuple);
+}
+
+/*
+ * Look the arguments up in the result cache before running the invoker of the
+ * signature. The scalars are keyed by their Datums, which hold the values as
+ * int64 like the generic entry points pass them.
+ */
+static Datum wasm_invoke_memoized(FunctionCallInfo fcinfo, WasmCallPlan *plan)
+{
+    WasmMemoCache *memo = wasm_memo_cache();
+    if (memo == NULL) {
+        (void)wasm_vm_begin_call(plan->vm_entry, true);
+        return plan->invoker(fcinfo, plan);
+    }
+
+    int64 args[WASM_MEMO_MAX_ARGS];
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        args[i] = (int64)PG_GETARG_DATUM(i);
+    }
+    uint64 hash = wasm_memo_hash(plan->funcinfo, args, plan->param_num);
+    uint64 result;
+    if (wasm_memo_lookup(memo, plan->funcinfo, args, plan->param_num, hash, &result)) {
+        plan->stats->memo_hits.fetch_add(1, std::memory_order_relaxed);
+        return (Datum)result;
+    }
+    plan->stats->memo_misses.fetch_add(1, std::memory_order_relaxed);
+
+    (void)wasm_vm_begin_call(plan->vm_entry, true);
+    Datum ret = plan->invoker(fcinfo, plan);
+    wasm_memo_store(memo, plan->funcinfo, args, plan->param_num, hash, (uint64)ret);
+    return ret;
+}
+
+/*
+ * Point the argument kinds and converters of a plan, new or resolved again, at its
+ * inline arrays, or at arrays in fn_mcxt for an export taking more arguments.
+ */
+template <typename Plan>
+static void wasm_plan_reserve_params(Plan *plan, FmgrInfo *flinfo, uint32_t param_num)
+{
+    if (plan->params != NULL && plan->params != plan->inline_params) {
+        pfree(plan->params);
+        pfree(plan->converters);
+    }
+    if (param_num <= WASM_SPECIALIZED_PARAMS) {
+        plan->params = plan->inline_params;
+        plan->converters = plan->inline_converters;
+        return;
+    }
+    plan->params = (WasmValueKind *)MemoryContextAlloc(flinfo->fn_mcxt, param_num * sizeof(WasmValueKind));
+    plan->converters = (WasmArgConverter *)MemoryContextAlloc(flinfo->fn_mcxt, param_num * sizeof(WasmArgConverter));
+}
+
+/*
+ * Resolve the export bound to the calling SQL function once, checking that the
+ * declared SQL signature matches the one of the export.
+ */
+static WasmCallPlan* wasm_prepare_call_plan(FmgrInfo *flinfo)
+{
+    uint64 current_registry_generation = registry_generation.load();
+    WasmFuncBinding binding;
+    if (!find_binding(flinfo->fn_oid, binding)) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: function %u is not bound to a wasm exported function", flinfo->fn_oid)));
+    }
+    int64 instanceid = binding.instanceid;
+    WasmInstanceInfo *info = find_instance(instanceid);
+    WasmFuncInfo *funcinfo = find_exported_func(info, binding.funcname);
+
+    Oid *argtypes = NULL;
+    int nargs = 0;
+    Oid rettype = get_func_signature(flinfo->fn_oid, &argtypes, &nargs);
+    if (nargs != (int)funcinfo->param_num) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: function %u takes %d arguments but func %s takes %u",
+                flinfo->fn_oid, nargs, funcinfo->funcname.c_str(), funcinfo->param_num)));
+    }
+
+    WasmCallPlan *plan = (WasmCallPlan *)flinfo->fn_extra;
+    if (plan == NULL) {
+        plan = (WasmCallPlan *)MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(WasmCallPlan));
+    }
+    wasm_plan_reserve_params(plan, flinfo, (uint32_t)nargs);
+    bool scalar = !WASM_VALUE_IS_VARLENA(funcinfo->result);
+    plan->wasm_param_num = 0;
+    for (int i = 0; i < nargs; ++i) {
+        plan->params[i] = funcinfo->params[i];
+        if (argtypes[i] != wasm_kind_type(plan->params[i])) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: argument %d of function %u does not match func %s", i + 1, flinfo->fn_oid,
+                    funcinfo->funcname.c_str())));
+        }
+        plan->converters[i] = wasm_arg_converter(plan->params[i]);
+        plan->wasm_param_num += WASM_VALUE_IS_VARLENA(plan->params[i]) ? 2 : 1;
+        scalar = scalar && !WASM_VALUE_IS_VARLENA(plan->params[i]);
+    }
+    plan->result = funcinfo->result;
+    plan->return_num = funcinfo->result_num;
+    plan->tupdesc = NULL;
+    if (plan->result == WASM_VALUE_RECORD && !scalar) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s returns several values and can only take numeric values",
+                funcinfo->funcname.c_str())));
+    }
+    if (rettype != wasm_kind_type(plan->result)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: result of function %u does not match func %s", flinfo->fn_oid,
+                funcinfo->funcname.c_str())));
+    }
+    if (plan->result == WASM_VALUE_RECORD) {
+        plan->invoker = wasm_invoke_record;
+    } else if (scalar && nargs > WASM_SPECIALIZED_PARAMS) {
+        plan->invoker = wasm_invoke_scalar_any;
+    } else if (scalar) {
+        // the columns follow the order of the scalar kinds, VOID comes last
+        plan->invoker = wasm_scalar_invokers[nargs][plan->result == WASM_VALUE_VOID ? 4 : plan->result];
+    } else {
+        plan->invoker = wasm_invoke_varlena;
+    }
+
+    plan->instanceid = instanceid;
+    plan->funcinfo = funcinfo;
+    plan->param_num = nargs;
+    plan->wasm_func = WasmEdge_StringWrap(funcinfo->funcname.c_str(), funcinfo->funcname.length());
+    plan->vm_entry = wasm_get_session_vm(info);
+    plan->stats = wasm_func_stats(plan->vm_entry->stats, funcinfo->funcname);
+    // the cache holds a single Datum per call, of a few arguments
+    plan->memoize = info->deterministic && scalar && plan->result != WASM_VALUE_VOID &&
+        plan->result != WASM_VALUE_RECORD && nargs <= WASM_MEMO_MAX_ARGS;
+    plan->session_generation = session_vms_generation;
+    plan->vm_serial = plan->vm_entry->serial;
+    plan->registry_generation = current_registry_generation;
+    flinfo->fn_extra = plan;
+    return plan;
+}
+
+/*
+ * Bind a generated SQL function to an exported function of an instance, so that
+ * wasm_invoke_export knows what to call.
+ */
+PG_FUNCTION_INFO_V1(wasm_bind_function);
+Datum wasm_bind_function(PG_FUNCTION_ARGS)
+{
+    Oid funcoid = PG_GETARG_OID(0);
+    int64 instanceid = PG_GETARG_INT64(1);
+    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(2));
+
+    if (!superuser())
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to bind wasm function"))));
+
+    // make sure the export exists before anything can call it
+    (void)find_exported_func(find_instance(instanceid), funcname);
+
+    WasmFuncBinding binding;
+    binding.instanceid = instanceid;
+    binding.funcname = funcname;
+    function_bindings.assign(funcoid, binding);
+    PG_RETURN_VOID();
+}
+
+/*
+ * Forget a dropped instance. Sessions notice through registry_generation and
+ * release their VMs of it; the entry itself is retired rather than freed since
+ * running calls may still refer to its exported functions.
+ */
+PG_FUNCTION_INFO_V1(wasm_remove_instance);
+Datum wasm_remove_instance(PG_FUNCTION_ARGS)
+{
+    int64 instanceid = PG_GETARG_INT64(0);
+
+    if (!superuser())
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to drop wasm instance"))));
+
+    WasmInstanceInfo *retired = NULL;
+    (void)instances.erase(instanceid, [&](WasmInstanceInfo *info) {
+        std::vector<uint8_t>().swap(info->bytes);
+        retired = info;
+    });
+    if (retired != NULL) {
+        pthread_mutex_lock(&retired_instances_lock);
+        retired_instances.push_back(retired);
+        pthread_mutex_unlock(&retired_instances_lock);
+    }
+    function_bindings.erase_if([&](Oid funcoid, const WasmFuncBinding &binding) {
+        return binding.instanceid == instanceid;
+    });
+    // the counters stay allocated for the plans still pointing to them
+    (void)instance_stats.erase(instanceid, [](WasmInstanceStats *stats) {});
+    registry_generation++;
+    PG_RETURN_VOID();
+}
+
+// The wasm type of a scalar, or of a text or bytea result
+static enum WasmEdge_ValType wasm_lowered_type(WasmValueKind kind)
+{
+    switch (kind) {
+        case WASM_VALUE_I32:
+            return WasmEdge_ValType_I32;
+        case WASM_VALUE_F32:
+            return WasmEdge_ValType_F32;
+        case WASM_VALUE_F64:
+            return WasmEdge_ValType_F64;
+        default:
+            return WasmEdge_ValType_I64;
+    }
+}
+
+/*
+ * Declare the SQL types an export takes and returns, e.g. text where the module
+ * only sees (ptr i32, len i32). The declaration has to lower to the signature of
+ * the export. The registry entry is replaced by a copy with the new signature, the
+ * module and thus the VMs of the sessions stay the same.
+ */
+PG_FUNCTION_INFO_V1(wasm_declare_function);
+Datum wasm_declare_function(PG_FUNCTION_ARGS)
+{
+    int64 instanceid = PG_GETARG_INT64(0);
     char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    params.push_back(PG_GETARG_INT64(7));
-    params.push_back(PG_GETARG_INT64(8));
-    params.push_back(PG_GETARG_INT64(9));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    char* inputs = TextDatumGetCString(PG_GETARG_DATUM(2));
+    char* outputs = TextDatumGetCString(PG_GETARG_DATUM(3));
+
+    if (!superuser())
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), (errmsg("wasm_executor: must be system admin to declare wasm function"))));
+
+    WasmInstanceInfo *info = find_instance(instanceid);
+    (void)find_exported_func(info, funcname);
+
+    std::vector<std::string> input_types;
+    wasm_split_inputs(inputs, input_types);
+    std::vector<enum WasmEdge_ValType> lowered;
+    for (unsigned int i = 0; i < input_types.size(); ++i) {
+        WasmValueKind kind;
+        if (!wasm_kind_of(input_types[i], &kind)) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: not support the type %s for now", input_types[i].c_str())));
+        }
+        if (WASM_VALUE_IS_VARLENA(kind)) {
+            lowered.push_back(WasmEdge_ValType_I32);
+            lowered.push_back(WasmEdge_ValType_I32);
+        } else {
+            lowered.push_back(wasm_lowered_type(kind));
+        }
+    }
+    std::vector<std::string> output_types;
+    wasm_split_inputs(outputs, output_types);
+    std::vector<enum WasmEdge_ValType> lowered_results;
+    for (unsigned int i = 0; i < output_types.size(); ++i) {
+        WasmValueKind kind;
+        if (!wasm_kind_of(output_types[i], &kind)) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: not support the type %s for now", output_types[i].c_str())));
+        }
+        if (output_types.size() > 1 && WASM_VALUE_IS_VARLENA(kind)) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: the results of func %s have to be numeric to return several", funcname)));
+        }
+        lowered_results.push_back(wasm_lowered_type(kind));
+    }
+
+    WasmVMEntry *vm_entry = wasm_get_session_vm(info);
+    const WasmEdge_FunctionTypeContext *func_type =
+        WasmEdge_VMGetFunctionType(vm_entry->vm, WasmEdge_StringWrap(funcname, strlen(funcname)));
+    std::vector<enum WasmEdge_ValType> param_buffer(WasmEdge_FunctionTypeGetParametersLength(func_type));
+    enum WasmEdge_ValType return_buffer[MAX_RETURNS];
+    uint32_t param_num = WasmEdge_FunctionTypeGetParameters(func_type, param_buffer.data(), param_buffer.size());
+    uint32_t return_num = WasmEdge_FunctionTypeGetReturns(func_type, return_buffer, MAX_RETURNS);
+    bool matches = (param_num == lowered.size()) && (return_num == lowered_results.size());
+    for (uint32_t i = 0; matches && i < param_num; ++i) {
+        matches = (param_buffer[i] == lowered[i]);
+    }
+    for (uint32_t i = 0; matches && i < return_num; ++i) {
+        matches = (return_buffer[i] == lowered_results[i]);
+    }
+    if (!matches) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: (%s) -> %s does not match the signature of func %s", inputs,
+                outputs[0] != '\0' ? outputs : "void", funcname),
+            errhint("text and bytea are passed as (i32, i32) and returned as i64.")));
+    }
+
+    WasmInstanceInfo *declared = wasm_copy_instance_info(info);
+    for (std::vector<WasmFuncInfo*>::iterator curr = declared->functions.begin(); curr != declared->functions.end(); curr++) {
+        WasmFuncInfo *funcinfo = *curr;
+        if (funcinfo->funcname == funcname) {
+            funcinfo->inputs = input_types;
+            funcinfo->outputs = outputs;
+            (void)wasm_encode_signature(funcinfo);
+        }
+    }
+    registry_replace(declared);
+    PG_RETURN_VOID();
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_9);
-Datum wasm_invoke_function_9(PG_FUNCTION_ARGS)
+/*
+ * The single entry point of all generated SQL functions. After the first call the
+ * export is run by the invoker of its signature without any lookup.
+ */
+PG_FUNCTION_INFO_V1(wasm_invoke_export);
+Datum wasm_invoke_export(PG_FUNCTION_ARGS)
 {
-    char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
+    WasmCallPlan *plan = (WasmCallPlan *)fcinfo->flinfo->fn_extra;
+    if (plan == NULL ||
+        !wasm_session_vm_current(plan->instanceid, plan->vm_entry, plan->vm_serial, &plan->session_generation) ||
+        plan->registry_generation != registry_generation.load(std::memory_order_relaxed)) {
+        plan = wasm_prepare_call_plan(fcinfo->flinfo);
+    }
+
+    if (plan->memoize) {
+        return wasm_invoke_memoized(fcinfo, plan);
+    }
+    (void)wasm_vm_begin_call(plan->vm_entry, true);
+    return plan->invoker(fcinfo, plan);
+}
+
+/*
+ * The support functions of an aggregate generated from <name>_init() -> i32,
+ * <name>_step(i32, ...) -> i32, <name>_final(i32) -> i32|i64 and optionally
+ * <name>_combine(i32, i32) -> i32. The state of every group is a region of the
+ * linear memory of the session VM, which the exports allocate and may move, and
+ * the step is run on that VM for every row.
+ */
+typedef struct WasmAggPlan {
+    uint64 session_generation;
+    uint64 registry_generation;
+    int64 instanceid;
+    WasmVMEntry *vm_entry;
+    uint64 vm_serial;
+    WasmEdge_String func; // the bound export, <name>_step, <name>_combine or <name>_final
+    WasmEdge_String init_func;
+    WasmFuncStats *stats;
+    WasmFuncStats *init_stats;
+    uint32_t param_num; // of the step, without the state
+    WasmValueKind *params; // inline_params, or in fn_mcxt for wider exports
+    WasmArgConverter *converters;
+    uint32_t return_num;
+    WasmValueKind result;
+    WasmValueKind inline_params[WASM_SPECIALIZED_PARAMS];
+    WasmArgConverter inline_converters[WASM_SPECIALIZED_PARAMS];
+} WasmAggPlan;
+
+// The transition value of a group, allocated in the aggregate context
+typedef struct WasmAggState {
+    int64 instanceid;
+    WasmVMEntry *vm_entry;
+    uint64 vm_serial;
+    uint64 session_generation;
+    uint64 snapshot_epoch; // a restore of the snapshot in between wipes the state out
+    uint32_t state; // address of the state in the linear memory
+} WasmAggState;
+
+static bool wasm_has_suffix(const std::string &name, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return name.length() > len && name.compare(name.length() - len, len, suffix) == 0;
+}
+
+static WasmAggPlan* wasm_prepare_agg_plan(FmgrInfo *flinfo, const char *suffix)
+{
+    uint64 current_registry_generation = registry_generation.load();
+    WasmFuncBinding binding;
+    if (!find_binding(flinfo->fn_oid, binding) || !wasm_has_suffix(binding.funcname, suffix)) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: function %u is not bound to a wasm %s function", flinfo->fn_oid, suffix)));
+    }
+    WasmInstanceInfo *info = find_instance(binding.instanceid);
+    WasmFuncInfo *funcinfo = find_exported_func(info, binding.funcname);
+    std::string aggname = binding.funcname.substr(0, binding.funcname.length() - strlen(suffix));
+
+    WasmAggPlan *plan = (WasmAggPlan *)flinfo->fn_extra;
+    if (plan == NULL) {
+        plan = (WasmAggPlan *)MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(WasmAggPlan));
+    }
+    if (funcinfo->param_num == 0 || funcinfo->params[0] != WASM_VALUE_I32) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s has to take the i32 address of the state first", funcinfo->funcname.c_str())));
+    }
+    wasm_plan_reserve_params(plan, flinfo, funcinfo->param_num - 1);
+    plan->param_num = funcinfo->param_num - 1;
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        plan->params[i] = funcinfo->params[i + 1];
+        plan->converters[i] = wasm_arg_converter(plan->params[i]);
+        if (plan->converters[i] == NULL) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: func %s can only take numeric values", funcinfo->funcname.c_str())));
+        }
+    }
+    plan->result = funcinfo->result;
+    plan->return_num = (plan->result == WASM_VALUE_VOID) ? 0 : 1;
+    if (WASM_VALUE_IS_VARLENA(plan->result) || plan->result == WASM_VALUE_RECORD) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s can only return a numeric value", funcinfo->funcname.c_str())));
+    }
+
+    if (strcmp(suffix, "_final") == 0 && (plan->param_num != 0 || plan->return_num != 1)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s has to take the state and return the result", funcinfo->funcname.c_str())));
+    }
+    if (strcmp(suffix, "_combine") == 0 && (plan->param_num != 1 || plan->params[0] != WASM_VALUE_I32)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s has to take the addresses of two states", funcinfo->funcname.c_str())));
+    }
+    if (strcmp(suffix, "_final") != 0 && plan->return_num == 1 && plan->result != WASM_VALUE_I32) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s can only return the i32 address of the state", funcinfo->funcname.c_str())));
+    }
+
+    plan->func = WasmEdge_StringWrap(funcinfo->funcname.c_str(), funcinfo->funcname.length());
+    if (strcmp(suffix, "_step") == 0) {
+        WasmFuncInfo *init = find_exported_func(info, aggname + "_init");
+        if (init->param_num != 0 || init->result != WASM_VALUE_I32) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: func %s has to return the i32 address of a new state", init->funcname.c_str())));
+        }
+        plan->init_func = WasmEdge_StringWrap(init->funcname.c_str(), init->funcname.length());
+    }
+    plan->instanceid = info->instanceid;
+    plan->vm_entry = wasm_get_session_vm(info);
+    plan->vm_serial = plan->vm_entry->serial;
+    plan->stats = wasm_func_stats(plan->vm_entry->stats, funcinfo->funcname);
+    if (strcmp(suffix, "_step") == 0) {
+        plan->init_stats = wasm_func_stats(plan->vm_entry->stats, aggname + "_init");
+    }
+    plan->session_generation = session_vms_generation;
+    plan->registry_generation = current_registry_generation;
+    flinfo->fn_extra = plan;
+    return plan;
+}
+
+static WasmAggPlan* wasm_get_agg_plan(FunctionCallInfo fcinfo, const char *suffix)
+{
+    if (!AggCheckCallContext(fcinfo, NULL)) {
+        ereport(ERROR, (errmsg("wasm_executor: aggregate function called in non-aggregate context")));
+    }
+    WasmAggPlan *plan = (WasmAggPlan *)fcinfo->flinfo->fn_extra;
+    if (plan == NULL ||
+        !wasm_session_vm_current(plan->instanceid, plan->vm_entry, plan->vm_serial, &plan->session_generation) ||
+        plan->registry_generation != registry_generation.load(std::memory_order_relaxed)) {
+        plan = wasm_prepare_agg_plan(fcinfo->flinfo, suffix);
+    }
+    return plan;
+}
+
+// The state has to live in the VM the plan runs on
+static void wasm_check_agg_state(WasmAggPlan *plan, WasmAggState *state)
+{
+    if (state->vm_entry != plan->vm_entry ||
+        !wasm_session_vm_current(state->instanceid, state->vm_entry, state->vm_serial, &state->session_generation)) {
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("wasm_executor: the VM holding the aggregate state of instance %ld was released",
+                state->instanceid)));
+    }
+    if (state->snapshot_epoch != wasm_vm_epoch(plan->vm_entry)) {
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("wasm_executor: the aggregate state of instance %ld was reset by another call of the instance",
+                plan->vm_entry->instanceid),
+            errhint("Functions of an instance isolated by snapshot cannot be called while one of its aggregates is.")));
+    }
+}
+
+// Keep the state where the export says it is now, steps returning nothing keep it in place
+static void wasm_update_agg_state(WasmAggPlan *plan, WasmAggState *state, WasmEdge_Value *result)
+{
+    if (plan->return_num == 1) {
+        state->state = (uint32_t)WasmEdge_ValueGetI32(result[0]);
+    }
+}
+
+PG_FUNCTION_INFO_V1(wasm_aggregate_step);
+Datum wasm_aggregate_step(PG_FUNCTION_ARGS)
+{
+    WasmAggPlan *plan = wasm_get_agg_plan(fcinfo, "_step");
+    WasmAggState *state = PG_ARGISNULL(0) ? NULL : (WasmAggState *)PG_GETARG_POINTER(0);
+
+    if (state == NULL) {
+        MemoryContext aggcontext;
+        (void)AggCheckCallContext(fcinfo, &aggcontext);
+        state = (WasmAggState *)MemoryContextAlloc(aggcontext, sizeof(WasmAggState));
+        state->instanceid = plan->instanceid;
+        state->vm_entry = plan->vm_entry;
+        state->vm_serial = plan->vm_serial;
+        state->session_generation = plan->session_generation;
+        // the groups share the memory, so the state carries on from whatever is there
+        state->snapshot_epoch = wasm_vm_begin_call(plan->vm_entry, false);
+        WasmEdge_Value result[MAX_RETURNS];
+        wasm_vm_execute(plan->vm_entry, plan->init_stats, plan->init_func, NULL, 0, result, 1);
+        state->state = (uint32_t)WasmEdge_ValueGetI32(result[0]);
+    }
+    wasm_check_agg_state(plan, state);
+
+    // rows with a NULL value are skipped, like strict transition functions do
+    WasmCallBuffer<WasmEdge_Value> params(plan->param_num + 1);
+    params[0] = WasmEdge_ValueGenI32((int32_t)state->state);
+    for (uint32_t i = 0; i < plan->param_num; ++i) {
+        if (PG_ARGISNULL(i + 1)) {
+            PG_RETURN_POINTER(state);
+        }
+        params[i + 1] = plan->converters[i](PG_GETARG_DATUM(i + 1));
+    }
+
+    WasmEdge_Value result[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->func, params.data(), plan->param_num + 1, result,
+        plan->return_num);
+    wasm_update_agg_state(plan, state, result);
+    PG_RETURN_POINTER(state);
+}
+
+/*
+ * Merge the second state into the first. openGauss only passes internal states
+ * between the functions of one thread, so both states live in the same VM.
+ */
+PG_FUNCTION_INFO_V1(wasm_aggregate_combine);
+Datum wasm_aggregate_combine(PG_FUNCTION_ARGS)
+{
+    WasmAggPlan *plan = wasm_get_agg_plan(fcinfo, "_combine");
+    WasmAggState *state = PG_ARGISNULL(0) ? NULL : (WasmAggState *)PG_GETARG_POINTER(0);
+    WasmAggState *other = PG_ARGISNULL(1) ? NULL : (WasmAggState *)PG_GETARG_POINTER(1);
+
+    if (other == NULL) {
+        if (state == NULL) {
+            PG_RETURN_NULL();
+        }
+        PG_RETURN_POINTER(state);
+    }
+    if (state == NULL) {
+        PG_RETURN_POINTER(other);
+    }
+    wasm_check_agg_state(plan, state);
+    wasm_check_agg_state(plan, other);
+
+    WasmEdge_Value params[2];
+    params[0] = WasmEdge_ValueGenI32((int32_t)state->state);
+    params[1] = WasmEdge_ValueGenI32((int32_t)other->state);
+    WasmEdge_Value result[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->func, params, 2, result, plan->return_num);
+    wasm_update_agg_state(plan, state, result);
+    PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(wasm_aggregate_final);
+Datum wasm_aggregate_final(PG_FUNCTION_ARGS)
+{
+    WasmAggPlan *plan = wasm_get_agg_plan(fcinfo, "_final");
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+    WasmAggState *state = (WasmAggState *)PG_GETARG_POINTER(0);
+    wasm_check_agg_state(plan, state);
+
+    WasmEdge_Value param = WasmEdge_ValueGenI32((int32_t)state->state);
+    WasmEdge_Value result[MAX_RETURNS];
+    wasm_vm_execute(plan->vm_entry, plan->stats, plan->func, &param, 1, result, 1);
+    switch (plan->result) {
+        case WASM_VALUE_I32:
+            PG_RETURN_DATUM(WasmValueTraits<WASM_VALUE_I32>::to_datum(result[0]));
+        case WASM_VALUE_F32:
+            PG_RETURN_DATUM(WasmValueTraits<WASM_VALUE_F32>::to_datum(result[0]));
+        case WASM_VALUE_F64:
+            PG_RETURN_DATUM(WasmValueTraits<WASM_VALUE_F64>::to_datum(result[0]));
+        default:
+            PG_RETURN_DATUM(WasmValueTraits<WASM_VALUE_I64>::to_datum(result[0]));
+    }
+}
+
+/*
+ * A set-returning function generated from <name>_open(...) -> i32, which returns a
+ * handle, <name>_next(i32 handle, i32 out) -> i32, which stores the next i64 value
+ * at out and returns 0 once there is none, and optionally <name>_close(i32 handle).
+ * The values are returned one per call straight from the session VM, nothing is
+ * materialized. text and bytea arguments of the open stay in the linear memory
+ * until the set is closed.
+ */
+typedef struct WasmSrfState {
+    int64 instanceid;
+    WasmVMEntry *vm_entry;
+    uint64 vm_serial;
+    uint64 session_generation;
+    uint64 snapshot_epoch;
+    WasmEdge_String next_func;
+    WasmEdge_String close_func; // Buf is NULL without <name>_close
+    WasmFuncStats *next_stats;
+    WasmFuncStats *close_stats;
+    uint32_t handle;
+    uint32_t out; // where next stores the value
+    uint32_t *guest_ptrs; // one for each text or bytea argument of the open
+    uint32_t *guest_sizes;
+    uint32_t guest_num;
+    bool open;
+    ExprContext *econtext;
+} WasmSrfState;
+
+#define WASM_SRF_VALUE_SIZE sizeof(int64)
+
+// Whether the VM of the set still holds what the set allocated in it
+static bool wasm_srf_vm_intact(WasmSrfState *state)
+{
+    return wasm_session_vm_current(state->instanceid, state->vm_entry, state->vm_serial, &state->session_generation) &&
+        state->snapshot_epoch == wasm_vm_epoch(state->vm_entry);
+}
+
+// Give back the copies of the arguments and the value buffer, as far as they were allocated
+static void wasm_srf_release_guest(WasmSrfState *state)
+{
+    if (state->out != 0) {
+        wasm_guest_dealloc(state->vm_entry, state->out, WASM_SRF_VALUE_SIZE);
+        state->out = 0;
+    }
+    for (uint32_t i = 0; i < state->guest_num; ++i) {
+        wasm_guest_dealloc(state->vm_entry, state->guest_ptrs[i], state->guest_sizes[i] > 0 ? state->guest_sizes[i] : 1);
+    }
+    state->guest_num = 0;
+}
+
+static void wasm_srf_close(WasmSrfState *state)
+{
+    if (!state->open) {
+        return;
+    }
+    state->open = false;
+    if (!wasm_srf_vm_intact(state)) {
+        return; // the VM is gone or was restored, and everything in it
+    }
+    if (state->close_func.Buf != NULL) {
+        WasmEdge_Value param = WasmEdge_ValueGenI32((int32_t)state->handle);
+        wasm_vm_execute(state->vm_entry, state->close_stats, state->close_func, &param, 1, NULL, 0);
+    }
+    wasm_srf_release_guest(state);
+}
+
+// Called when the scan ends before the set is exhausted, e.g. under a LIMIT
+static void wasm_srf_shutdown(Datum arg)
+{
+    wasm_srf_close((WasmSrfState *)DatumGetPointer(arg));
+}
+
+static WasmSrfState* wasm_srf_open(FunctionCallInfo fcinfo)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("wasm_executor: set-valued function called in context that cannot accept a set")));
+    }
+
+    WasmFuncBinding binding;
+    if (!find_binding(fcinfo->flinfo->fn_oid, binding) || !wasm_has_suffix(binding.funcname, "_open")) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+            errmsg("wasm_executor: function %u is not bound to a wasm _open function", fcinfo->flinfo->fn_oid)));
+    }
+    WasmInstanceInfo *info = find_instance(binding.instanceid);
+    WasmFuncInfo *open_info = find_exported_func(info, binding.funcname);
+    std::string name = binding.funcname.substr(0, binding.funcname.length() - strlen("_open"));
+    WasmFuncInfo *next_info = find_exported_func(info, name + "_next");
+    WasmFuncInfo *close_info = NULL;
+    for (std::vector<WasmFuncInfo*>::iterator curr = info->functions.begin(); curr != info->functions.end(); curr++) {
+        if ((*curr)->funcname == name + "_close") {
+            close_info = *curr;
+        }
+    }
+
+    if (open_info->result != WASM_VALUE_I32 || next_info->param_num != 2 || next_info->params[0] != WASM_VALUE_I32 ||
+        next_info->params[1] != WASM_VALUE_I32 || next_info->result != WASM_VALUE_I32 ||
+        (close_info != NULL && (close_info->param_num != 1 || close_info->params[0] != WASM_VALUE_I32))) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s has to return a handle which %s_next(handle, out) and %s_close(handle) take",
+                open_info->funcname.c_str(), name.c_str(), name.c_str())));
+    }
+
+    Oid *argtypes = NULL;
+    int nargs = 0;
+    (void)get_func_signature(fcinfo->flinfo->fn_oid, &argtypes, &nargs);
+    if (nargs != (int)open_info->param_num) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: function %u takes %d arguments but func %s takes %u",
+                fcinfo->flinfo->fn_oid, nargs, open_info->funcname.c_str(), open_info->param_num)));
+    }
+
+    for (int i = 0; i < nargs; ++i) {
+        if (argtypes[i] != wasm_kind_type(open_info->params[i])) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: argument %d of function %u does not match func %s", i + 1,
+                    fcinfo->flinfo->fn_oid, open_info->funcname.c_str())));
+        }
+    }
+
+    WasmSrfState *state = (WasmSrfState *)MemoryContextAllocZero(rsinfo->econtext->ecxt_per_query_memory,
+        sizeof(WasmSrfState));
+    state->instanceid = info->instanceid;
+    state->vm_entry = wasm_get_session_vm(info);
+    state->vm_serial = state->vm_entry->serial;
+    state->session_generation = session_vms_generation;
+    state->snapshot_epoch = wasm_vm_begin_call(state->vm_entry, true);
+    state->next_func = WasmEdge_StringWrap(next_info->funcname.c_str(), next_info->funcname.length());
+    state->next_stats = wasm_func_stats(state->vm_entry->stats, next_info->funcname);
+    if (close_info != NULL) {
+        state->close_func = WasmEdge_StringWrap(close_info->funcname.c_str(), close_info->funcname.length());
+        state->close_stats = wasm_func_stats(state->vm_entry->stats, close_info->funcname);
+    }
+    state->econtext = rsinfo->econtext;
+    if (nargs > 0) {
+        state->guest_ptrs = (uint32_t *)MemoryContextAlloc(rsinfo->econtext->ecxt_per_query_memory,
+            nargs * sizeof(uint32_t));
+        state->guest_sizes = (uint32_t *)MemoryContextAlloc(rsinfo->econtext->ecxt_per_query_memory,
+            nargs * sizeof(uint32_t));
+    }
+
+    // text and bytea take two
+    WasmCallBuffer<WasmEdge_Value> params(2 * (size_t)nargs);
+    uint32_t wasm_param_num = 0;
+    WasmEdge_Value result;
+    // the set is not open yet, so a failure gives back here what was allocated in the session VM
+    PG_TRY();
+    {
+        for (int i = 0; i < nargs; ++i) {
+            WasmValueKind kind = open_info->params[i];
+            if (WASM_VALUE_IS_VARLENA(kind)) {
+                state->guest_ptrs[state->guest_num] =
+                    wasm_guest_copy_varlena(state->vm_entry, PG_GETARG_DATUM(i), &state->guest_sizes[state->guest_num]);
+                params[wasm_param_num++] = WasmEdge_ValueGenI32((int32_t)state->guest_ptrs[state->guest_num]);
+                params[wasm_param_num++] = WasmEdge_ValueGenI32((int32_t)state->guest_sizes[state->guest_num]);
+                state->guest_num++;
+            } else {
+                params[wasm_param_num++] = wasm_arg_converter(kind)(PG_GETARG_DATUM(i));
+            }
+        }
+
+        state->out = wasm_guest_alloc(state->vm_entry, WASM_SRF_VALUE_SIZE);
+        wasm_vm_execute(state->vm_entry, wasm_func_stats(state->vm_entry->stats, open_info->funcname),
+            WasmEdge_StringWrap(open_info->funcname.c_str(), open_info->funcname.length()), params.data(),
+            wasm_param_num, &result, 1);
+    }
+    PG_CATCH();
+    {
+        if (wasm_srf_vm_intact(state)) {
+            wasm_srf_release_guest(state);
+        }
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    state->handle = (uint32_t)WasmEdge_ValueGetI32(result);
+    state->open = true;
+    RegisterExprContextCallback(state->econtext, wasm_srf_shutdown, PointerGetDatum(state));
+    return state;
+}
+
+PG_FUNCTION_INFO_V1(wasm_invoke_srf);
+Datum wasm_invoke_srf(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *fctx = NULL;
+
+    if (SRF_IS_FIRSTCALL()) {
+        fctx = SRF_FIRSTCALL_INIT();
+        fctx->user_fctx = wasm_srf_open(fcinfo);
+    }
+
+    fctx = SRF_PERCALL_SETUP();
+    WasmSrfState *state = (WasmSrfState *)fctx->user_fctx;
+    if (!wasm_session_vm_current(state->instanceid, state->vm_entry, state->vm_serial, &state->session_generation)) {
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("wasm_executor: the VM of instance %ld was released while returning a set", state->instanceid)));
+    }
+    if (state->snapshot_epoch != wasm_vm_epoch(state->vm_entry)) {
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+            errmsg("wasm_executor: the set of instance %ld was reset by another call of the instance",
+                state->vm_entry->instanceid),
+            errhint("Functions of an instance isolated by snapshot cannot be called while one of its sets is returned.")));
+    }
+
+    WasmEdge_Value params[2];
+    WasmEdge_Value result;
+    params[0] = WasmEdge_ValueGenI32((int32_t)state->handle);
+    params[1] = WasmEdge_ValueGenI32((int32_t)state->out);
+    wasm_vm_execute(state->vm_entry, state->next_stats, state->next_func, params, 2, &result, 1);
+    if (WasmEdge_ValueGetI32(result) != 0) {
+        const uint8_t *data = WasmEdge_MemoryInstanceGetPointerConst(wasm_guest_memory(state->vm_entry), state->out,
+            WASM_SRF_VALUE_SIZE);
+        if (data == NULL) {
+            ereport(ERROR, (errmsg("wasm_executor: instance %ld has no room for a value at %u",
+                state->vm_entry->instanceid, state->out)));
+        }
+        int64 value;
+        errno_t rc = memcpy_s(&value, sizeof(value), data, WASM_SRF_VALUE_SIZE);
+        securec_check(rc, "\0", "\0");
+        SRF_RETURN_NEXT(fctx, Int64GetDatum(value));
+    }
+
+    UnregisterExprContextCallback(state->econtext, wasm_srf_shutdown, PointerGetDatum(state));
+    wasm_srf_close(state);
+    SRF_RETURN_DONE(fctx);
+}
+
+/*
+ * Run the exported function once per array element: the i-th call takes the i-th
+ * element of every array. All calls share the session VM and one argument buffer,
+ * and a NULL element makes the corresponding result NULL.
+ */
+PG_FUNCTION_INFO_V1(wasm_invoke_batch);
+Datum wasm_invoke_batch(PG_FUNCTION_ARGS)
+{
+    int64 instanceid = PG_GETARG_INT64(0);
     char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-    
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    params.push_back(PG_GETARG_INT64(7));
-    params.push_back(PG_GETARG_INT64(8));
-    params.push_back(PG_GETARG_INT64(9));
-    params.push_back(PG_GETARG_INT64(10));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
-    return Int64GetDatum(result);
+    int nargs = PG_NARGS() - 2;
+
+    WasmInstanceInfo *info = find_instance(instanceid);
+    WasmFuncInfo *funcinfo = find_exported_func(info, funcname);
+    wasm_check_scalar_func(funcinfo);
+    // every call gives an element of the result
+    if (funcinfo->result == WASM_VALUE_VOID) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s returns void and cannot be called through wasm_invoke_batch", funcname)));
+    }
+    if (nargs == 0 || nargs != (int)funcinfo->inputs.size()) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: func %s takes %d arrays but %d are given", funcname, (int)funcinfo->inputs.size(), nargs)));
+    }
+
+    WasmCallBuffer<Datum *> arg_values(nargs);
+    WasmCallBuffer<bool *> arg_nulls(nargs);
+    WasmCallBuffer<bool> arg_is_int4(nargs);
+    WasmCallBuffer<bool> param_is_i32(nargs);
+    int nitems = 0;
+    for (int i = 0; i < nargs; ++i) {
+        Oid argtype = get_fn_expr_argtype(fcinfo->flinfo, i + 2);
+        if (argtype != INT4ARRAYOID && argtype != INT8ARRAYOID) {
+            ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                errmsg("wasm_executor: batch arguments must be integer[] or bigint[]")));
+        }
+        ArrayType *array = PG_GETARG_ARRAYTYPE_P(i + 2);
+        if (ARR_NDIM(array) > 1) {
+            ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                errmsg("wasm_executor: batch arguments must be one-dimensional arrays")));
+        }
+
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        int elem_num;
+        get_typlenbyvalalign(ARR_ELEMTYPE(array), &typlen, &typbyval, &typalign);
+        deconstruct_array(array, ARR_ELEMTYPE(array), typlen, typbyval, typalign, &arg_values[i], &arg_nulls[i], &elem_num);
+        if (i > 0 && elem_num != nitems) {
+            ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                errmsg("wasm_executor: batch arguments must have the same length")));
+        }
+        nitems = elem_num;
+        arg_is_int4[i] = (ARR_ELEMTYPE(array) == INT4OID);
+        param_is_i32[i] = (funcinfo->params[i] == WASM_VALUE_I32);
+    }
+    if (nitems == 0) {
+        PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+    }
+
+    WasmVMEntry *vm_entry = wasm_get_session_vm(info);
+    WasmFuncStats *stats = wasm_func_stats(vm_entry->stats, funcinfo->funcname);
+    WasmEdge_String wasm_func = WasmEdge_StringWrap(funcname, strlen(funcname));
+    bool result_is_i32 = (funcinfo->result == WASM_VALUE_I32);
+    WasmCallBuffer<WasmEdge_Value> params(nargs);
+    WasmEdge_Value result[MAX_RETURNS];
+    Datum *result_values = (Datum *)palloc(nitems * sizeof(Datum));
+    bool *result_nulls = (bool *)palloc(nitems * sizeof(bool));
+
+    for (int row = 0; row < nitems; ++row) {
+        result_nulls[row] = false;
+        for (int i = 0; i < nargs; ++i) {
+            if (arg_nulls[i][row]) {
+                result_nulls[row] = true;
+                break;
+            }
+            int64 value = arg_is_int4[i] ? DatumGetInt32(arg_values[i][row]) : DatumGetInt64(arg_values[i][row]);
+            params[i] = param_is_i32[i] ? WasmEdge_ValueGenI32(value) : WasmEdge_ValueGenI64(value);
+        }
+        if (result_nulls[row]) {
+            result_values[row] = (Datum)0;
+            continue;
+        }
+
+        // every row is a call of its own
+        (void)wasm_vm_begin_call(vm_entry, true);
+        wasm_vm_execute(vm_entry, stats, wasm_func, params.data(), nargs, result, 1);
+        result_values[row] = Int64GetDatum(result_is_i32 ? WasmEdge_ValueGetI32(result[0]) : WasmEdge_ValueGetI64(result[0]));
+    }
+
+    int dims[1] = {nitems};
+    int lbs[1] = {1};
+    PG_RETURN_ARRAYTYPE_P(construct_md_array(result_values, result_nulls, 1, dims, lbs, INT8OID, sizeof(int64), true, 'd'));
+}
+
+/*
+ * Whole-array mode: copy the array into the linear memory of the instance once and
+ * call an export taking (ptr i32, len i32), len being the number of elements.
+ */
+PG_FUNCTION_INFO_V1(wasm_invoke_array);
+Datum wasm_invoke_array(PG_FUNCTION_ARGS)
+{
+    int64 instanceid = PG_GETARG_INT64(0);
+    char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(2);
+
+    WasmInstanceInfo *info = find_instance(instanceid);
+    WasmFuncInfo *funcinfo = find_exported_func(info, funcname);
+    if (funcinfo->param_num != 2 || funcinfo->params[0] != WASM_VALUE_I32 || funcinfo->params[1] != WASM_VALUE_I32) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("wasm_executor: func %s has to take (ptr i32, len i32) to be called on a whole array", funcname)));
+    }
+    if (!WASM_VALUE_IS_INTEGER(funcinfo->result)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: func %s returns %s and can only be called through its generated function",
+                funcname, funcinfo->outputs.length() > 0 ? funcinfo->outputs.c_str() : "void")));
+    }
+    if (ARR_ELEMTYPE(array) != INT4OID && ARR_ELEMTYPE(array) != INT8OID) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: whole-array argument must be integer[] or bigint[]")));
+    }
+    if (array_contains_nulls(array)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+            errmsg("wasm_executor: whole-array argument must not contain NULL")));
+    }
+
+    int nitems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    uint32_t size = (uint32_t)nitems * (ARR_ELEMTYPE(array) == INT4OID ? sizeof(int32) : sizeof(int64));
+    WasmVMEntry *vm_entry = wasm_get_session_vm(info);
+    wasm_check_value_size(vm_entry, (uint64)nitems * (ARR_ELEMTYPE(array) == INT4OID ? sizeof(int32) : sizeof(int64)));
+    (void)wasm_vm_begin_call(vm_entry, true);
+    // an empty array is passed as (0, 0), allocators may return 0 for no bytes
+    uint32_t ptr = 0;
+    if (nitems > 0) {
+        ptr = wasm_guest_alloc(vm_entry, size);
+        wasm_guest_write(vm_entry, ptr, ARR_DATA_PTR(array), size);
+    }
+
+    WasmEdge_Value params[2];
+    WasmEdge_Value result[MAX_RETURNS];
+    params[0] = WasmEdge_ValueGenI32((int32_t)ptr);
+    params[1] = WasmEdge_ValueGenI32(nitems);
+    wasm_vm_execute(vm_entry, wasm_func_stats(vm_entry->stats, funcinfo->funcname),
+        WasmEdge_StringWrap(funcname, strlen(funcname)), params, 2, result, 1);
+    if (nitems > 0) {
+        wasm_guest_dealloc(vm_entry, ptr, size);
+    }
+
+    if (funcinfo->result == WASM_VALUE_I32) {
+        PG_RETURN_INT64(WasmEdge_ValueGetI32(result[0]));
+    }
+    PG_RETURN_INT64(WasmEdge_ValueGetI64(result[0]));
 }
 
-PG_FUNCTION_INFO_V1(wasm_invoke_function_10);
-Datum wasm_invoke_function_10(PG_FUNCTION_ARGS)
+/*
+ * The generic entry point, wasm_invoke_function(instance, func, VARIADIC args),
+ * for exports taking any number of integers. Their arguments come as one bigint
+ * array, passed to the export as it is.
+ */
+PG_FUNCTION_INFO_V1(wasm_invoke_function_variadic);
+Datum wasm_invoke_function_variadic(PG_FUNCTION_ARGS)
 {
     char* instanceid = TextDatumGetCString(PG_GETARG_DATUM(0));
     char* funcname = TextDatumGetCString(PG_GETARG_DATUM(1));
-    std::vector<int64> params;
-
-    params.push_back(PG_GETARG_INT64(2));
-    params.push_back(PG_GETARG_INT64(3));
-    params.push_back(PG_GETARG_INT64(4));
-    params.push_back(PG_GETARG_INT64(5));
-    params.push_back(PG_GETARG_INT64(6));
-    params.push_back(PG_GETARG_INT64(7));
-    params.push_back(PG_GETARG_INT64(8));
-    params.push_back(PG_GETARG_INT64(9));
-    params.push_back(PG_GETARG_INT64(10));
-    params.push_back(PG_GETARG_INT64(11));
-    int64 result = wasm_invoke_function(instanceid, funcname, params);
+    if (PG_NARGS() < 3) {
+        return Int64GetDatum(wasm_invoke_function(instanceid, funcname, NULL, 0));
+    }
+
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(2);
+    if (ARR_ELEMTYPE(array) != INT8OID || ARR_NDIM(array) > 1) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+            errmsg("wasm_executor: the arguments of func %s must be a one-dimensional bigint[]", funcname)));
+    }
+    if (array_contains_nulls(array)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+            errmsg("wasm_executor: the arguments of func %s must not contain NULL", funcname)));
+    }
+    int nargs = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    int64 result = wasm_invoke_function(instanceid, funcname, (const int64 *)ARR_DATA_PTR(array), (uint32_t)nargs);
     return Int64GetDatum(result);
 }
@@ -0,0 +1,181 @@
+/* contrib/wasm/wasm_registry.h */
+
+#ifndef WASM_REGISTRY_H
+#define WASM_REGISTRY_H
+
+#include <map>
+#include <pthread.h>
+
+/*
+ * A map shared by all sessions, which openGauss runs as threads of one process.
+ * Lookups by far outnumber registrations, so the keys are spread over shards with
+ * a reader-writer lock each: readers never wait for each other, and a registration
+ * only blocks the readers of its own shard. Each shard sits on its own cache line
+ * so that taking a read lock does not bounce the lines of the others.
+ *
+ * Values are copied in and out under the shard lock; pointers stored as values
+ * must stay valid for as long as readers may hold them.
+ */
+#define WASM_REGISTRY_SHARDS 16
+#define WASM_CACHE_LINE_SIZE 64
+
+template <typename Key, typename Value>
+class WasmShardedMap {
+public:
+    WasmShardedMap()
+    {
+        for (int i = 0; i < WASM_REGISTRY_SHARDS; ++i) {
+            pthread_rwlock_init(&shards[i].lock, NULL);
+        }
+    }
+
+    ~WasmShardedMap()
+    {
+        for (int i = 0; i < WASM_REGISTRY_SHARDS; ++i) {
+            pthread_rwlock_destroy(&shards[i].lock);
+        }
+    }
+
+    bool lookup(const Key &key, Value &value)
+    {
+        Shard &shard = shard_of(key);
+        bool found = false;
+        pthread_rwlock_rdlock(&shard.lock);
+        typename std::map<Key, Value>::iterator itor = shard.map.find(key);
+        if (itor != shard.map.end()) {
+            value = itor->second;
+            found = true;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+        return found;
+    }
+
+    /*
+     * Run visitor on the value of key while holding the shard's read lock, which
+     * keeps erase() and its callback out until visitor returns.
+     */
+    template <typename Visitor>
+    bool visit(const Key &key, Visitor visitor)
+    {
+        Shard &shard = shard_of(key);
+        bool found = false;
+        pthread_rwlock_rdlock(&shard.lock);
+        typename std::map<Key, Value>::iterator itor = shard.map.find(key);
+        if (itor != shard.map.end()) {
+            visitor(itor->second);
+            found = true;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+        return found;
+    }
+
+    // Insert unless key is present. Either way, value is set to the entry in the map.
+    bool insert(const Key &key, Value &value)
+    {
+        Shard &shard = shard_of(key);
+        pthread_rwlock_wrlock(&shard.lock);
+        std::pair<typename std::map<Key, Value>::iterator, bool> inserted =
+            shard.map.insert(std::pair<Key, Value>(key, value));
+        value = inserted.first->second;
+        pthread_rwlock_unlock(&shard.lock);
+        return inserted.second;
+    }
+
+    void assign(const Key &key, const Value &value)
+    {
+        Shard &shard = shard_of(key);
+        pthread_rwlock_wrlock(&shard.lock);
+        shard.map[key] = value;
+        pthread_rwlock_unlock(&shard.lock);
+    }
+
+    // Replace the value of a present key, running on_replace on the old value under the write lock
+    template <typename Callback>
+    bool replace(const Key &key, const Value &value, Callback on_replace)
+    {
+        Shard &shard = shard_of(key);
+        bool found = false;
+        pthread_rwlock_wrlock(&shard.lock);
+        typename std::map<Key, Value>::iterator itor = shard.map.find(key);
+        if (itor != shard.map.end()) {
+            on_replace(itor->second);
+            itor->second = value;
+            found = true;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+        return found;
+    }
+
+    // Remove key, running on_erase on its value before the write lock is released
+    template <typename Callback>
+    bool erase(const Key &key, Callback on_erase)
+    {
+        Shard &shard = shard_of(key);
+        bool found = false;
+        pthread_rwlock_wrlock(&shard.lock);
+        typename std::map<Key, Value>::iterator itor = shard.map.find(key);
+        if (itor != shard.map.end()) {
+            on_erase(itor->second);
+            shard.map.erase(itor);
+            found = true;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+        return found;
+    }
+
+    // Remove every entry pred holds for, one shard at a time
+    template <typename Predicate>
+    void erase_if(Predicate pred)
+    {
+        for (int i = 0; i < WASM_REGISTRY_SHARDS; ++i) {
+            pthread_rwlock_wrlock(&shards[i].lock);
+            typename std::map<Key, Value>::iterator itor = shards[i].map.begin();
+            while (itor != shards[i].map.end()) {
+                if (pred(itor->first, itor->second)) {
+                    shards[i].map.erase(itor++);
+                } else {
+                    itor++;
+                }
+            }
+            pthread_rwlock_unlock(&shards[i].lock);
+        }
+    }
+
+    /*
+     * Run visitor on every entry, one shard at a time. This is not an atomic
+     * snapshot of the whole map, but every entry seen was present while its shard
+     * was locked.
+     */
+    template <typename Visitor>
+    void for_each(Visitor visitor)
+    {
+        for (int i = 0; i < WASM_REGISTRY_SHARDS; ++i) {
+            pthread_rwlock_rdlock(&shards[i].lock);
+            for (typename std::map<Key, Value>::iterator itor = shards[i].map.begin();
+                 itor != shards[i].map.end(); itor++) {
+                visitor(itor->first, itor->second);
+            }
+            pthread_rwlock_unlock(&shards[i].lock);
+        }
+    }
+
+private:
+    struct Shard {
+        pthread_rwlock_t lock;
+        std::map<Key, Value> map;
+    } __attribute__((aligned(WASM_CACHE_LINE_SIZE)));
+
+    Shard &shard_of(const Key &key)
+    {
+        // instance ids are hashes already and oids are sequential, both spread well
+        unsigned long long k = (unsigned long long)key;
+        return shards[(k ^ (k >> 32)) % WASM_REGISTRY_SHARDS];
+    }
+
+    Shard shards[WASM_REGISTRY_SHARDS];
+
+    WasmShardedMap(const WasmShardedMap &);
+    WasmShardedMap &operator=(const WasmShardedMap &);
+};
+
+#endif /* WASM_REGISTRY_H */